@@ -6,23 +6,26 @@
 #include <rtkThreeDCircularProjectionGeometryXMLFile.h>
 
 #include "pctProtonPairsToBackProjection.h"
-#include "SmallHoleFiller.h"
+#include "pctHoleFillingImageFilter.h"
 
+#include <itkClampImageFilter.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
 #include <itkRegularExpressionSeriesFileNames.h>
 #include <itkTimeProbe.h>
 #include <itkChangeInformationImageFilter.h>
 
+#include <type_traits>
+
+template <class TCountImage>
 int
-main(int argc, char * argv[])
+BackProjectionBinning(const args_info_pctbackprojectionbinning & args_info)
 {
-  GGO(pctbackprojectionbinning, args_info);
-
   using OutputPixelType = float;
   const unsigned int Dimension = 4;
   using OutputImageType = itk::Image<OutputPixelType, Dimension>;
-  using ProjectionFilter = pct::ProtonPairsToBackProjection<OutputImageType, OutputImageType>;
+  using CountImageType = TCountImage;
+  using ProjectionFilter = pct::ProtonPairsToBackProjection<OutputImageType, OutputImageType, CountImageType>;
 
   // Generate file names
   itk::RegularExpressionSeriesFileNames::Pointer names = itk::RegularExpressionSeriesFileNames::New();
@@ -35,8 +38,8 @@ main(int argc, char * argv[])
     std::cout << "Regular expression matches " << names->GetFileNames().size() << " file(s)..." << std::endl;
 
   // Read or create bp images
-  OutputImageType::Pointer            inBp;
-  ProjectionFilter::CountImagePointer inCount;
+  OutputImageType::Pointer                     inBp;
+  typename ProjectionFilter::CountImagePointer inCount;
   if (args_info.bpVal_given)
   {
     if (args_info.verbose_flag)
@@ -48,11 +51,24 @@ main(int argc, char * argv[])
     TRY_AND_EXIT_ON_ITK_EXCEPTION(readBPVal->Update());
     inBp = readBPVal->GetOutput();
 
-    itk::ImageFileReader<ProjectionFilter::CountImageType>::Pointer readBPCount =
-      itk::ImageFileReader<ProjectionFilter::CountImageType>::New();
+    // The counts of a previous run may be on 32 bits, they are clamped to the
+    // saturation value of CountPixelType which preserves the averages
+    using WideCountImageType = itk::Image<unsigned int, Dimension>;
+    itk::ImageFileReader<WideCountImageType>::Pointer readBPCount = itk::ImageFileReader<WideCountImageType>::New();
     readBPCount->SetFileName(args_info.bpCount_arg);
-    TRY_AND_EXIT_ON_ITK_EXCEPTION(readBPCount->Update());
-    inCount = readBPCount->GetOutput();
+    if constexpr (std::is_same<CountImageType, WideCountImageType>::value)
+    {
+      TRY_AND_EXIT_ON_ITK_EXCEPTION(readBPCount->Update());
+      inCount = readBPCount->GetOutput();
+    }
+    else
+    {
+      using ClampType = itk::ClampImageFilter<WideCountImageType, CountImageType>;
+      typename ClampType::Pointer clamp = ClampType::New();
+      clamp->SetInput(readBPCount->GetOutput());
+      TRY_AND_EXIT_ON_ITK_EXCEPTION(clamp->Update());
+      inCount = clamp->GetOutput();
+    }
   }
   else
   {
@@ -65,20 +81,22 @@ main(int argc, char * argv[])
     TRY_AND_EXIT_ON_ITK_EXCEPTION(constantImageSource->Update());
     inBp = constantImageSource->GetOutput();
 
-    rtk::ConstantImageSource<ProjectionFilter::CountImageType>::Pointer countSource =
-      rtk::ConstantImageSource<ProjectionFilter::CountImageType>::New();
-    rtk::SetConstantImageSourceFromGgo<rtk::ConstantImageSource<ProjectionFilter::CountImageType>,
-                                       args_info_pctbackprojectionbinning>(countSource, args_info);
+    typename rtk::ConstantImageSource<CountImageType>::Pointer countSource =
+      rtk::ConstantImageSource<CountImageType>::New();
+    rtk::SetConstantImageSourceFromGgo<rtk::ConstantImageSource<CountImageType>, args_info_pctbackprojectionbinning>(
+      countSource, args_info);
     TRY_AND_EXIT_ON_ITK_EXCEPTION(countSource->Update());
     inCount = countSource->GetOutput();
   }
 
   // Projection filter
-  ProjectionFilter::Pointer projection = ProjectionFilter::New();
+  typename ProjectionFilter::Pointer projection = ProjectionFilter::New();
   projection->SetInput(inBp);
   projection->SetCounts(inCount);
   projection->SetProtonPairsFileNames(names->GetFileNames());
+  projection->SetNumberOfPrefetchedFiles(args_info.prefetch_arg);
   projection->SetMostLikelyPathType(args_info.mlptype_arg);
+  projection->SetMostLikelyPathTableStep(args_info.mlptable_arg);
   projection->SetIonizationPotential(args_info.ionpot_arg * CLHEP::eV);
   projection->SetDisableRotation(args_info.norotation_flag);
 
@@ -94,7 +112,7 @@ main(int argc, char * argv[])
   if (args_info.quadricIn_given)
   {
     // quadric = object surface
-    ProjectionFilter::RQIType::Pointer qIn = ProjectionFilter::RQIType::New();
+    typename ProjectionFilter::RQIType::Pointer qIn = ProjectionFilter::RQIType::New();
     qIn->SetA(args_info.quadricIn_arg[0]);
     qIn->SetB(args_info.quadricIn_arg[1]);
     qIn->SetC(args_info.quadricIn_arg[2]);
@@ -109,7 +127,7 @@ main(int argc, char * argv[])
   }
   if (args_info.quadricOut_given)
   {
-    ProjectionFilter::RQIType::Pointer qOut = ProjectionFilter::RQIType::New();
+    typename ProjectionFilter::RQIType::Pointer qOut = ProjectionFilter::RQIType::New();
     qOut->SetA(args_info.quadricOut_arg[0]);
     qOut->SetB(args_info.quadricOut_arg[1]);
     qOut->SetC(args_info.quadricOut_arg[2]);
@@ -125,18 +143,21 @@ main(int argc, char * argv[])
 
   TRY_AND_EXIT_ON_ITK_EXCEPTION(projection->Update());
 
-  SmallHoleFiller<OutputImageType> filler;
+  using FillerType = pct::HoleFillingImageFilter<OutputImageType>;
+  FillerType::Pointer filler = FillerType::New();
   if (args_info.fill_flag)
   {
-    filler.SetImage(projection->GetOutput());
-    filler.SetHolePixel(0.);
-    filler.Fill();
+    filler->SetInput(projection->GetOutput());
+    filler->SetHolePixel(0.);
+    TRY_AND_EXIT_ON_ITK_EXCEPTION(filler->Update())
+    if (args_info.verbose_flag)
+      std::cout << "Holes filled in " << filler->GetNumberOfLayers() << " layers." << std::endl;
   }
 
   using CIIType = itk::ChangeInformationImageFilter<OutputImageType>;
   CIIType::Pointer cii = CIIType::New();
   if (args_info.fill_flag)
-    cii->SetInput(filler.GetOutput());
+    cii->SetInput(filler->GetOutput());
   else
     cii->SetInput(projection->GetOutput());
   cii->ChangeOriginOn();
@@ -156,8 +177,8 @@ main(int argc, char * argv[])
   if (args_info.count_given)
   {
     // Write
-    using CountWriterType = itk::ImageFileWriter<ProjectionFilter::CountImageType>;
-    CountWriterType::Pointer cwriter = CountWriterType::New();
+    using CountWriterType = itk::ImageFileWriter<CountImageType>;
+    typename CountWriterType::Pointer cwriter = CountWriterType::New();
     cwriter->SetFileName(args_info.count_arg);
     cwriter->SetInput(projection->GetCounts());
     TRY_AND_EXIT_ON_ITK_EXCEPTION(cwriter->Update())
@@ -165,3 +186,13 @@ main(int argc, char * argv[])
 
   return EXIT_SUCCESS;
 }
+
+int
+main(int argc, char * argv[])
+{
+  GGO(pctbackprojectionbinning, args_info);
+
+  if (args_info.compact_flag)
+    return BackProjectionBinning<itk::Image<unsigned short, 4>>(args_info);
+  return BackProjectionBinning<itk::Image<unsigned int, 4>>(args_info);
+}
@@ -5,7 +5,7 @@
 #include <rtkConstantImageSource.h>
 
 #include "pctProtonPairsToDistanceDrivenProjection.h"
-#include "SmallHoleFiller.h"
+#include "pctHoleFillingImageFilter.h"
 
 #include <itkImageFileWriter.h>
 #include <itkRegularExpressionSeriesFileNames.h>
@@ -23,13 +23,16 @@ main(int argc, char * argv[])
     return EXIT_FAILURE;
   }
 
+  if (args_info.pairsinram_arg < 0)
+  {
+    std::cerr << "--pairsinram must be positive or 0" << std::endl;
+    return EXIT_FAILURE;
+  }
+
   using OutputPixelType = float;
   const unsigned int Dimension = 3;
   using OutputImageType = itk::Image<OutputPixelType, Dimension>;
 
-  itk::MultiThreaderBase::SetGlobalMaximumNumberOfThreads(
-    std::min<double>(8., itk::MultiThreaderBase::GetGlobalMaximumNumberOfThreads()));
-
   // Create a stack of empty projection images
   using ConstantImageSourceType = rtk::ConstantImageSource<OutputImageType>;
   ConstantImageSourceType::Pointer constantImageSource = ConstantImageSourceType::New();
@@ -41,9 +44,12 @@ main(int argc, char * argv[])
   ProjectionFilter::Pointer projection = ProjectionFilter::New();
   projection->SetInput(constantImageSource->GetOutput());
   projection->SetProtonPairsFileName(args_info.input_arg);
+  projection->SetNumberOfPairsPerChunk(args_info.pairsinram_arg);
+  projection->SetAccumulationMemoryBudget(args_info.memory_arg);
   projection->SetSourceDistance(args_info.source_arg);
   projection->SetMostLikelyPathType(args_info.mlptype_arg);
   projection->SetMostLikelyPathPolynomialDegree(args_info.mlppolydeg_arg);
+  projection->SetMostLikelyPathTableStep(args_info.mlptable_arg);
   projection->SetMostLikelyPathTrackerUncertainties(args_info.mlptrackeruncert_flag);
   projection->SetTrackerResolution(args_info.trackerresolution_arg);
   projection->SetTrackerPairSpacing(args_info.trackerspacing_arg);
@@ -86,19 +92,24 @@ main(int argc, char * argv[])
   }
 
   TRY_AND_EXIT_ON_ITK_EXCEPTION(projection->Update());
+  if (args_info.verbose_flag)
+    projection->PrintTiming(std::cout);
 
-  SmallHoleFiller<OutputImageType> filler;
+  using FillerType = pct::HoleFillingImageFilter<OutputImageType>;
+  FillerType::Pointer filler = FillerType::New();
   if (args_info.fill_flag)
   {
-    filler.SetImage(projection->GetOutput());
-    filler.SetHolePixel(0.);
-    filler.Fill();
+    filler->SetInput(projection->GetOutput());
+    filler->SetHolePixel(0.);
+    TRY_AND_EXIT_ON_ITK_EXCEPTION(filler->Update())
+    if (args_info.verbose_flag)
+      std::cout << "Holes filled in " << filler->GetNumberOfLayers() << " layers." << std::endl;
   }
 
   using CIIType = itk::ChangeInformationImageFilter<OutputImageType>;
   CIIType::Pointer cii = CIIType::New();
   if (args_info.fill_flag)
-    cii->SetInput(filler.GetOutput());
+    cii->SetInput(filler->GetOutput());
   else
     cii->SetInput(projection->GetOutput());
   cii->ChangeOriginOn();
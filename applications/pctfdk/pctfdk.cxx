@@ -59,6 +59,26 @@ main(int argc, char * argv[])
   pssf->SetGeometry(geometryReader->GetOutputObject());
   pssf->InPlaceOff();
 
+  if (args_info.lowmem_flag)
+  {
+    // The reconstruction requests the projections subset by subset, release
+    // each subset once it has been consumed instead of keeping it buffered
+    reader->GetOutput()->ReleaseDataFlagOn();
+    pssf->GetOutput()->ReleaseDataFlagOn();
+  }
+  else
+  {
+    // Read and weight the whole stack of projections once
+    if (args_info.verbose_flag)
+      std::cout << "Reading projections... " << std::flush;
+    itk::TimeProbe readerProbe;
+    readerProbe.Start();
+    TRY_AND_EXIT_ON_ITK_EXCEPTION(pssf->Update())
+    readerProbe.Stop();
+    if (args_info.verbose_flag)
+      std::cout << "It took " << readerProbe.GetMean() << ' ' << readerProbe.GetUnit() << std::endl;
+  }
+
   // Create reconstructed image
   using ConstantImageSourceType = rtk::ConstantImageSource<OutputImageType>;
   ConstantImageSourceType::Pointer constantImageSource = ConstantImageSourceType::New();
@@ -70,6 +90,8 @@ main(int argc, char * argv[])
   feldkamp->SetInput(0, constantImageSource->GetOutput());
   feldkamp->SetProjectionStack(pssf->GetOutput());
   feldkamp->SetGeometry(geometryReader->GetOutputObject());
+  feldkamp->SetProjectionSubsetSize(args_info.subsetsize_arg);
+  feldkamp->SetNumberOfSubsetsAhead(args_info.subsetsahead_arg);
   feldkamp->GetRampFilter()->SetTruncationCorrection(args_info.pad_arg);
   feldkamp->GetRampFilter()->SetHannCutFrequency(args_info.hann_arg);
   feldkamp->GetRampFilter()->SetHannCutFrequencyY(args_info.hannY_arg);
@@ -3,7 +3,7 @@
 #include <rtkMacro.h>
 #include <rtkGgoFunctions.h>
 
-#include "SmallHoleFiller.h"
+#include "pctHoleFillingImageFilter.h"
 
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
@@ -24,14 +24,17 @@ main(int argc, char * argv[])
   reader->SetFileName(args_info.input_arg);
   TRY_AND_EXIT_ON_ITK_EXCEPTION(reader->Update());
 
-  SmallHoleFiller<OutputImageType> filler;
-  filler.SetImage(reader->GetOutput());
-  filler.SetHolePixel(0.);
-  filler.Fill();
+  using FillerType = pct::HoleFillingImageFilter<OutputImageType>;
+  FillerType::Pointer filler = FillerType::New();
+  filler->SetInput(reader->GetOutput());
+  filler->SetHolePixel(0.);
+  TRY_AND_EXIT_ON_ITK_EXCEPTION(filler->Update())
+  if (args_info.verbose_flag)
+    std::cout << "Holes filled in " << filler->GetNumberOfLayers() << " layers." << std::endl;
 
   using CIIType = itk::ChangeInformationImageFilter<OutputImageType>;
   CIIType::Pointer cii = CIIType::New();
-  cii->SetInput(filler.GetOutput());
+  cii->SetInput(filler->GetOutput());
   cii->ChangeOriginOn();
   cii->ChangeDirectionOn();
   cii->ChangeSpacingOn();
@@ -10,6 +10,7 @@
 #include "pctSchulteMLPFunction.h"
 #include "pctEnergyStragglingFunctor.h"
 #include "pctBetheBlochFunctor.h"
+#include "pctP2QuantileEstimator.h"
 
 #include <itkImageFileWriter.h>
 #include <itkRegularExpressionSeriesFileNames.h>
@@ -37,6 +38,11 @@ main(int argc, char * argv[])
     return EXIT_FAILURE;
   }
 #endif
+  if (args_info.sketch_flag && (!args_info.robust_flag || args_info.robustopt_arg != 0))
+  {
+    std::cerr << "--sketch requires --robust with --robustopt 0." << std::endl;
+    return EXIT_FAILURE;
+  }
 
   using ProjectionPixelType = float;
   using ProjectionImageType = itk::Image<ProjectionPixelType, 2>;
@@ -68,6 +74,16 @@ main(int argc, char * argv[])
   std::vector<std::vector<double>> energies(npixels);
   std::vector<std::vector<double>> angles(npixels);
 
+  // Robust case with sketches, the quantiles of each pixel are estimated
+  // with fixed-size streaming estimators instead of storing all pairs
+  std::vector<pct::P2QuantileEstimator> energyMedians, energySigmas, angleSigmas;
+  if (args_info.sketch_flag)
+  {
+    energyMedians.assign(npixels, pct::P2QuantileEstimator(0.5));
+    energySigmas.assign(npixels, pct::P2QuantileEstimator(0.3085)); // 0.5 sigma
+    angleSigmas.assign(npixels, pct::P2QuantileEstimator(0.3830));  // 0.5 sigma
+  }
+
   pct::Functor::IntegratedBetheBlochProtonStoppingPowerInverse<float, double> * ConvFunc;
   ConvFunc = new pct::Functor::IntegratedBetheBlochProtonStoppingPowerInverse<float, double>(
     68.9984 * CLHEP::eV, 600. * CLHEP::MeV, 0.1 * CLHEP::keV);
@@ -159,7 +175,15 @@ main(int argc, char * argv[])
       const double angley = std::acos(std::min(1., dInY * dOutY / (dInY.GetNorm() * dOutY.GetNorm())));
       const double energy = (data[0] == 0.) ? data[1] : data[0] - data[1];
 
-      if (args_info.robust_flag || (args_info.plotpix_given && idx == (unsigned long)args_info.plotpix_arg))
+      if (args_info.sketch_flag)
+      {
+        energyMedians[idx].Add(energy);
+        energySigmas[idx].Add(energy);
+        angleSigmas[idx].Add(anglex);
+        angleSigmas[idx].Add(angley);
+      }
+      if ((args_info.robust_flag && !args_info.sketch_flag) ||
+          (args_info.plotpix_given && idx == (unsigned long)args_info.plotpix_arg))
       {
         energies[idx].push_back(energy);
         angles[idx].push_back(anglex);
@@ -183,7 +207,26 @@ main(int argc, char * argv[])
 
   std::cout << "Finalize cuts..." << std::endl;
   // Now compute the cuts and the average
-  if (args_info.robust_flag)
+  if (args_info.sketch_flag)
+  {
+    for (unsigned int idx = 0; idx < npixels; idx++)
+    {
+      if (pCounts[idx] == 1)
+      {
+        // Just one event in this pixel, keep it!
+        pSumEnergy[idx] = energyMedians[idx].GetObservation(0);
+        pSumEnergySq[idx] = 0.1;
+        pSumAngleSq[idx] = angleSigmas[idx].GetObservation(0);
+      }
+      else if (pCounts[idx])
+      {
+        pSumEnergy[idx] = energyMedians[idx].GetQuantile();
+        pSumEnergySq[idx] = 2. * (pSumEnergy[idx] - energySigmas[idx].GetQuantile()); // x2 to get 1sigma
+        pSumAngleSq[idx] = 2. * angleSigmas[idx].GetQuantile();                       // x2 to get 1sigma
+      }
+    }
+  }
+  else if (args_info.robust_flag)
   {
     for (unsigned int idx = 0; idx < npixels; idx++)
     {
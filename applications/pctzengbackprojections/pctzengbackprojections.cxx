@@ -20,23 +20,27 @@ main(int argc, char * argv[])
   itk::ImageFileReader<InputImageType>::Pointer reader;
   reader = itk::ImageFileReader<InputImageType>::New();
   reader->SetFileName(args_info.input_arg);
-  TRY_AND_EXIT_ON_ITK_EXCEPTION(reader->Update())
+  TRY_AND_EXIT_ON_ITK_EXCEPTION(reader->UpdateOutputInformation())
 
   using ZengFilterType = pct::ZengBackProjectionImageFilter<InputImageType>;
+  using OutputImageType = ZengFilterType::OutputImageType;
   ZengFilterType::Pointer zeng;
   zeng = ZengFilterType::New();
   zeng->SetInput(reader->GetOutput());
-  TRY_AND_EXIT_ON_ITK_EXCEPTION(zeng->Update())
+  TRY_AND_EXIT_ON_ITK_EXCEPTION(zeng->UpdateOutputInformation())
 
-  using WriterType = itk::ImageFileWriter<ZengFilterType::OutputImageType>;
+  // With several slabs, each output is streamed slab by slab along the last
+  // spatial dimension through its writer and only the current slab of the
+  // input is read with all its angles
+  using WriterType = itk::ImageFileWriter<OutputImageType>;
   WriterType::Pointer writer = WriterType::New();
+  writer->SetNumberOfStreamDivisions(std::max(args_info.slabs_arg, 1));
   writer->SetInput(zeng->GetOutput(0));
   writer->SetFileName(args_info.outputc_arg);
-  TRY_AND_EXIT_ON_ITK_EXCEPTION(writer->UpdateLargestPossibleRegion())
+  TRY_AND_EXIT_ON_ITK_EXCEPTION(writer->Update())
   writer->SetInput(zeng->GetOutput(1));
   writer->SetFileName(args_info.outputs_arg);
-  TRY_AND_EXIT_ON_ITK_EXCEPTION(writer->UpdateLargestPossibleRegion())
-
+  TRY_AND_EXIT_ON_ITK_EXCEPTION(writer->Update())
 
   return EXIT_SUCCESS;
 }
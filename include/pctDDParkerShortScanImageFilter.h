@@ -54,6 +54,10 @@ protected:
   DDParkerShortScanImageFilter() { this->SetInPlace(true); }
   ~DDParkerShortScanImageFilter() {}
 
+  /** Computes the table of Parker weights of the requested projections */
+  void
+  BeforeThreadedGenerateData() override;
+
   virtual void
   DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread) override;
 
@@ -70,6 +74,12 @@ private:
    */
   double m_InferiorCorner;
   double m_SuperiorCorner;
+
+  /** Parker weight of each column (first dimension) of each requested
+   * projection, stored projection by projection starting with
+   * m_FirstWeightedProjection. Empty if it is not a short scan. */
+  std::vector<typename TOutputImage::PixelType> m_Weights;
+  itk::IndexValueType                           m_FirstWeightedProjection = 0;
 }; // end of class
 
 } // end namespace pct
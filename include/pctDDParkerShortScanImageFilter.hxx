@@ -1,17 +1,20 @@
 #ifndef __pctDDParkerShortScanImageFilter_hxx
 #define __pctDDParkerShortScanImageFilter_hxx
 
-#include <itkImageRegionIteratorWithIndex.h>
+#include <itkImageRegionIterator.h>
 #include <itkMacro.h>
 
+#include <algorithm>
+
 namespace pct
 {
 
 template <class TInputImage, class TOutputImage>
 void
-DDParkerShortScanImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
-  const OutputImageRegionType & outputRegionForThread)
+DDParkerShortScanImageFilter<TInputImage, TOutputImage>::BeforeThreadedGenerateData()
 {
+  m_Weights.clear();
+
   // Get angular gaps and max gap
   std::vector<double> angularGaps = m_Geometry->GetAngularGapsWithNext(m_Geometry->GetGantryAngles());
   int                 nProj = angularGaps.size();
@@ -20,52 +23,16 @@ DDParkerShortScanImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerate
     if (angularGaps[iProj] > angularGaps[maxAngularGapPos])
       maxAngularGapPos = iProj;
 
-  // Input / ouput iterators
-  itk::ImageRegionConstIterator<InputImageType> itIn(this->GetInput(), outputRegionForThread);
-  itk::ImageRegionIterator<OutputImageType>     itOut(this->GetOutput(), outputRegionForThread);
-  itIn.GoToBegin();
-  itOut.GoToBegin();
-
   // Not a short scan if less than 20 degrees max gap, => nothing to do
   // FIXME: do nothing in parallel geometry, currently handled with a trick in the geometry object
   if (m_Geometry->GetSourceToDetectorDistances()[0] == 0. || angularGaps[maxAngularGapPos] < itk::Math::pi / 9)
-  {
-    if (this->GetInput() != this->GetOutput()) // If not in place, copy is
-                                               // required
-    {
-      while (!itIn.IsAtEnd())
-      {
-        itOut.Set(itIn.Get());
-        ++itIn;
-        ++itOut;
-      }
-    }
     return;
-  }
-
-  // Weight image parameters
-  typename WeightImageType::RegionType  region;
-  typename WeightImageType::SpacingType spacing;
-  typename WeightImageType::PointType   origin;
-  region.SetSize(0, outputRegionForThread.GetSize(0));
-  region.SetIndex(0, outputRegionForThread.GetIndex(0));
-  spacing[0] = this->GetInput()->GetSpacing()[0];
-  origin[0] = this->GetInput()->GetOrigin()[0];
-
-  // Create one line of weights
-  typename WeightImageType::Pointer weights = WeightImageType::New();
-  weights->SetSpacing(spacing);
-  weights->SetOrigin(origin);
-  weights->SetRegions(region);
-  weights->Allocate();
-  typename itk::ImageRegionIteratorWithIndex<WeightImageType> itWeights(weights, weights->GetLargestPossibleRegion());
 
   const std::vector<double>                 rotationAngles = m_Geometry->GetGantryAngles();
   const std::multimap<double, unsigned int> sortedAngles = m_Geometry->GetSortedAngles(m_Geometry->GetGantryAngles());
   const double                              detectorWidth =
     this->GetInput()->GetSpacing()[0] * this->GetInput()->GetLargestPossibleRegion().GetSize()[0];
 
-
   // Compute delta between first and last angle where there is weighting required
   // First angle
   std::multimap<double, unsigned int>::const_iterator itFirstAngle;
@@ -84,63 +51,109 @@ DDParkerShortScanImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerate
   double delta = 0.5 * (lastAngle - firstAngle - itk::Math::pi);
   delta = delta - 2 * itk::Math::pi * floor(delta / (2 * itk::Math::pi)); // between -2*PI and 2*PI
 
-  double sox = m_Geometry->GetSourceOffsetsX()[itIn.GetIndex()[2]];
-  double sid = m_Geometry->GetSourceToIsocenterDistances()[itIn.GetIndex()[2]];
-  double invsid = 1. / sqrt(sid * sid + sox * sox);
-  if (delta < atan(0.5 * detectorWidth * invsid))
-    itkWarningMacro(<< "You do not have enough data for proper Parker weighting (short scan)"
-                    << "Delta is " << delta * 180. / itk::Math::pi
-                    << " degrees and should be more than half the beam angle, i.e. "
-                    << atan(0.5 * detectorWidth * invsid) * 180. / itk::Math::pi << " degrees.");
-
-  for (unsigned int p = 0; p < outputRegionForThread.GetSize(3); p++)
+  // Requested projections and columns of the weight table
+  const OutputImageRegionType & requested = this->GetOutput()->GetRequestedRegion();
+  const unsigned int            nColumns = this->GetInput()->GetLargestPossibleRegion().GetSize(0);
+  const unsigned int            nRequested = requested.GetSize(3);
+  m_FirstWeightedProjection = requested.GetIndex(3);
+  m_Weights.resize(nRequested * nColumns);
+
+  // Physical coordinate of the first column and increment per column, with
+  // the image direction (TransformIndexToPhysicalPoint too slow per column)
+  typename InputImageType::PointType pointBase, pointIncrement;
+  typename InputImageType::IndexType index = this->GetInput()->GetLargestPossibleRegion().GetIndex();
+  this->GetInput()->TransformIndexToPhysicalPoint(index, pointBase);
+  index[0]++;
+  this->GetInput()->TransformIndexToPhysicalPoint(index, pointIncrement);
+  const double columnIncrement = pointIncrement[0] - pointBase[0];
+
+  // Largest half beam angle of the requested projections for the warning
+  double halfBeamAngle = 0.;
+  for (unsigned int p = 0; p < nRequested; p++)
   {
-    sox = m_Geometry->GetSourceOffsetsX()[itIn.GetIndex()[3]];
-    sid = m_Geometry->GetSourceToIsocenterDistances()[itIn.GetIndex()[3]];
-    invsid = 1. / sqrt(sid * sid + sox * sox);
-
-    // Prepare weights for current slice (depends on ProjectionOffsetsX)
-    typename WeightImageType::PointType point;
-    weights->TransformIndexToPhysicalPoint(itWeights.GetIndex(), point);
+    const unsigned int iProj = m_FirstWeightedProjection + p;
+    const double       sox = m_Geometry->GetSourceOffsetsX()[iProj];
+    const double       sid = m_Geometry->GetSourceToIsocenterDistances()[iProj];
+    const double       invsid = 1. / sqrt(sid * sid + sox * sox);
+    halfBeamAngle = std::max(halfBeamAngle, atan(0.5 * detectorWidth * invsid));
 
     // Parker's article assumes that the scan starts at 0, convert projection
     // angle accordingly
-    double beta = rotationAngles[itIn.GetIndex()[3]];
+    double beta = rotationAngles[iProj];
     beta = beta - firstAngle;
     if (beta < 0)
       beta += 2 * itk::Math::pi;
 
-    itWeights.GoToBegin();
-    while (!itWeights.IsAtEnd())
+    // Weights of the current projection (depends on ProjectionOffsetsX)
+    typename TOutputImage::PixelType * weights = m_Weights.data() + p * nColumns;
+    for (unsigned int i = 0; i < nColumns; i++)
     {
-      const double l = m_Geometry->ToUntiltedCoordinateAtIsocenter(itIn.GetIndex()[3], point[0]);
+      const double point = pointBase[0] + i * columnIncrement;
+      const double l = m_Geometry->ToUntiltedCoordinateAtIsocenter(iProj, point);
       double       alpha = atan(-1 * l * invsid);
       if (beta <= 2 * delta - 2 * alpha)
-        itWeights.Set(2. * pow(sin((itk::Math::pi * beta) / (4 * (delta - alpha))), 2.));
+        weights[i] = 2. * pow(sin((itk::Math::pi * beta) / (4 * (delta - alpha))), 2.);
       else if (beta <= itk::Math::pi - 2 * alpha)
-        itWeights.Set(2.);
+        weights[i] = 2.;
       else if (beta <= itk::Math::pi + 2 * delta)
-        itWeights.Set(2. * pow(sin((itk::Math::pi * (itk::Math::pi + 2 * delta - beta)) / (4 * (delta + alpha))), 2.));
+        weights[i] = 2. * pow(sin((itk::Math::pi * (itk::Math::pi + 2 * delta - beta)) / (4 * (delta + alpha))), 2.);
       else
-        itWeights.Set(0.);
+        weights[i] = 0.;
+    }
+  }
 
-      ++itWeights;
-      point[0] += spacing[0];
+  if (delta < halfBeamAngle)
+    itkWarningMacro(<< "You do not have enough data for proper Parker weighting (short scan)"
+                    << "Delta is " << delta * 180. / itk::Math::pi
+                    << " degrees and should be more than half the beam angle, i.e. "
+                    << halfBeamAngle * 180. / itk::Math::pi << " degrees.");
+}
+
+template <class TInputImage, class TOutputImage>
+void
+DDParkerShortScanImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
+  const OutputImageRegionType & outputRegionForThread)
+{
+  // Not a short scan, nothing to do
+  if (m_Weights.empty())
+  {
+    if (this->GetInput() != this->GetOutput()) // If not in place, copy is
+                                               // required
+    {
+      itk::ImageRegionConstIterator<InputImageType> itIn(this->GetInput(), outputRegionForThread);
+      itk::ImageRegionIterator<OutputImageType>     itOut(this->GetOutput(), outputRegionForThread);
+      while (!itIn.IsAtEnd())
+      {
+        itOut.Set(itIn.Get());
+        ++itIn;
+        ++itOut;
+      }
     }
+    return;
+  }
 
-    // Multiply each line of the current slice
+  // Multiply each line of each projection by the weights of its columns
+  const InputImageType *                    input = this->GetInput();
+  OutputImageType *                         output = this->GetOutput();
+  const unsigned int                        nColumns = input->GetLargestPossibleRegion().GetSize(0);
+  const unsigned int                        rowLength = outputRegionForThread.GetSize(0);
+  const itk::IndexValueType                 firstColumn = input->GetLargestPossibleRegion().GetIndex(0);
+  typename OutputImageRegionType::IndexType rowIndex = outputRegionForThread.GetIndex();
+  for (unsigned int p = 0; p < outputRegionForThread.GetSize(3); p++)
+  {
+    rowIndex[3] = outputRegionForThread.GetIndex(3) + p;
+    const typename TOutputImage::PixelType * weights =
+      m_Weights.data() + (rowIndex[3] - m_FirstWeightedProjection) * nColumns + (rowIndex[0] - firstColumn);
     for (unsigned int k = 0; k < outputRegionForThread.GetSize(2); k++)
     {
+      rowIndex[2] = outputRegionForThread.GetIndex(2) + k;
       for (unsigned int j = 0; j < outputRegionForThread.GetSize(1); j++)
       {
-        itWeights.GoToBegin();
-        while (!itWeights.IsAtEnd())
-        {
-          itOut.Set(itIn.Get() * itWeights.Get());
-          ++itWeights;
-          ++itIn;
-          ++itOut;
-        }
+        rowIndex[1] = outputRegionForThread.GetIndex(1) + j;
+        const typename InputImageType::PixelType * in = input->GetBufferPointer() + input->ComputeOffset(rowIndex);
+        typename OutputImageType::PixelType *      out = output->GetBufferPointer() + output->ComputeOffset(rowIndex);
+        for (unsigned int i = 0; i < rowLength; i++)
+          out[i] = in[i] * weights[i];
       }
     }
   }
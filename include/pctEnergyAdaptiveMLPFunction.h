@@ -125,8 +125,9 @@ public:
        double           eOut) override;
 
   /* Evaluate MLP in multiple depths u */
+  using Superclass::Evaluate;
   virtual void
-  Evaluate(std::vector<double> u, std::vector<double> & x, std::vector<double> & y) override;
+  Evaluate(const double * u, const size_t n, double * x, double * y) override;
 
   /** Evaluate the error (x,y) (equation 27) at depth z. */
   void
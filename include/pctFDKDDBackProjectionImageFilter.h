@@ -31,6 +31,8 @@ public:
   /** Run-time type information (and related methods). */
   itkOverrideGetNameOfClassMacro(FDKDDBackProjectionImageFilter);
 
+  /** Projection #iProj of the stack. It shares the buffer of the stack when
+   * the pixel types match, it is therefore only valid as long as the stack. */
   virtual ProjectionImagePointer
   GetDDProjection(const unsigned int iProj);
 
@@ -51,11 +53,34 @@ protected:
   };
   virtual ~FDKDDBackProjectionImageFilter() {};
 
+  /** Coefficients of the backprojection of one projection of the stack. The
+   * projection indices are ratios of affine functions of the voxel index
+   * (coefficients of the three indices and constant). */
+  struct ProjectionCoefficients
+  {
+    ProjectionImagePointer      projection;
+    const ProjectionPixelType * buffer;
+    long                        size[3];
+    long                        stride[3];
+    double                      num[2][TOutputImage::ImageDimension + 1];
+    double                      den[TOutputImage::ImageDimension + 1];
+    double                      dist[TOutputImage::ImageDimension + 1];
+  };
+
+  void
+  BeforeThreadedGenerateData() override;
+
   virtual void
   DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread) override;
 
+  void
+  AfterThreadedGenerateData() override;
+
   ProjectionStackPointer m_ProjectionStack;
 
+  /** Coefficients of all the projections of the stack, shared by the threads */
+  std::vector<ProjectionCoefficients> m_ProjectionCoefficients;
+
 private:
   FDKDDBackProjectionImageFilter(const Self &); // purposely not implemented
   void
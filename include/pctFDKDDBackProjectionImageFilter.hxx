@@ -1,68 +1,43 @@
 #ifndef __pctFDKDDBackProjectionImageFilter_hxx
 #define __pctFDKDDBackProjectionImageFilter_hxx
 
-#include <itkImageRegionIteratorWithIndex.h>
-#include <itkLinearInterpolateImageFunction.h>
+#include <itkImageRegionIterator.h>
 #include <rtkThreeDCircularProjectionGeometry.h>
 
+#include <algorithm>
+#include <type_traits>
+
 namespace pct
 {
 
-/**
- * GenerateData performs the accumulation
- */
 template <class TInputImage, class TOutputImage>
 void
-FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
-  const OutputImageRegionType & outputRegionForThread)
+FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::BeforeThreadedGenerateData()
 {
+  Superclass::BeforeThreadedGenerateData();
+
   const unsigned int Dimension = TInputImage::ImageDimension;
   const unsigned int nProj = m_ProjectionStack->GetLargestPossibleRegion().GetSize(Dimension);
   const unsigned int iFirstProj = m_ProjectionStack->GetLargestPossibleRegion().GetIndex(Dimension);
   const rtk::ThreeDCircularProjectionGeometry * geometry;
   geometry = this->GetGeometry();
 
-  // Create interpolator, could be any interpolation
-  using InterpolatorType = itk::LinearInterpolateImageFunction<ProjectionImageType, double>;
-  typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
-
-  // Iterators on volume input and output
-  using InputRegionIterator = itk::ImageRegionConstIterator<TInputImage>;
-  InputRegionIterator itIn(this->GetInput(), outputRegionForThread);
-  using OutputRegionIterator = itk::ImageRegionIteratorWithIndex<TOutputImage>;
-  OutputRegionIterator itOut(this->GetOutput(), outputRegionForThread);
-
-  // Initialize output region with input region in case the filter is not in
-  // place
-  if (this->GetInput() != this->GetOutput())
-  {
-    itIn.GoToBegin();
-    while (!itIn.IsAtEnd())
-    {
-      itOut.Set(itIn.Get());
-      ++itIn;
-      ++itOut;
-    }
-  }
-
   // Rotation center (assumed to be at 0 yet)
   typename TInputImage::PointType rotCenterPoint;
   rotCenterPoint.Fill(0.0);
   itk::ContinuousIndex<double, Dimension> rotCenterIndex;
   this->GetInput(0)->TransformPhysicalPointToContinuousIndex(rotCenterPoint, rotCenterIndex);
 
-  // Continuous index at which we interpolate
-  itk::ContinuousIndex<double, Dimension> pointProj;
-
   // Go over each projection
+  m_ProjectionCoefficients.resize(nProj);
   for (unsigned int iProj = iFirstProj; iProj < iFirstProj + nProj; iProj++)
   {
-    const double sid = geometry->GetSourceToIsocenterDistances()[iProj];
-    const double sdd = geometry->GetSourceToDetectorDistances()[iProj];
+    ProjectionCoefficients & coeffs = m_ProjectionCoefficients[iProj - iFirstProj];
+    const double             sid = geometry->GetSourceToIsocenterDistances()[iProj];
+    const double             sdd = geometry->GetSourceToDetectorDistances()[iProj];
 
     // Extract the current slice
     ProjectionImagePointer projection = this->GetDDProjection(iProj);
-    interpolator->SetInputImage(projection);
 
     // Index to index matrix normalized to have a correct backprojection weight
     // (1 at the isocenter)
@@ -104,60 +79,202 @@ FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenera
       matrix /= perspFactor;
     }
 
+    // Projection buffer, the continuous indices are shifted to start at 0 in the buffer
+    const typename ProjectionImageType::RegionType & projRegion = projection->GetBufferedRegion();
+    coeffs.projection = projection;
+    coeffs.buffer = projection->GetBufferPointer();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+      coeffs.size[i] = projRegion.GetSize(i);
+      coeffs.stride[i] = (i == 0) ? 1 : coeffs.stride[i - 1] * coeffs.size[i - 1];
+    }
 
-    // Go over each voxel
-    itOut.GoToBegin();
-    while (!itOut.IsAtEnd())
+    // Affine functions of the voxel index of the numerators of the two first
+    // projection indices, of the perspective denominator and of the distance
+    // driven index. In parallel geometry, the denominator is 1 and the weight
+    // 1/den^2 too.
+    for (unsigned int j = 0; j <= Dimension; j++)
     {
+      coeffs.num[0][j] = matrix[0][j];
+      coeffs.num[1][j] = matrix[1][j];
       if (sdd == 0.) // Parallel
       {
-        // Compute projection index
-        for (unsigned int i = 0; i < Dimension; i++)
-        {
-          pointProj[i] = matrix[i][Dimension];
-          for (unsigned int j = 0; j < Dimension; j++)
-            pointProj[i] += matrix[i][j] * itOut.GetIndex()[j];
-        }
+        coeffs.den[j] = (j == Dimension) ? 1. : 0.;
+        coeffs.dist[j] = matrix[2][j];
+      }
+      else // Cone-beam, distance driven
+      {
+        coeffs.den[j] = matrix[2][j];
+        coeffs.dist[j] = sid * coeffs.den[j] / m_ProjectionStack->GetSpacing()[Dimension - 1];
+      }
+    }
+    if (sdd != 0.)
+    {
+      const double distOrigin = m_ProjectionStack->GetOrigin()[Dimension - 1];
+      coeffs.dist[Dimension] -= (sid + distOrigin) / m_ProjectionStack->GetSpacing()[Dimension - 1];
+    }
+    for (unsigned int j = 0; j <= Dimension; j++)
+    {
+      coeffs.num[0][j] -= projRegion.GetIndex(0) * coeffs.den[j];
+      coeffs.num[1][j] -= projRegion.GetIndex(1) * coeffs.den[j];
+    }
+    coeffs.dist[Dimension] -= projRegion.GetIndex(2);
+  }
+}
 
-        // Interpolate if in projection
-        if (interpolator->IsInsideBuffer(pointProj))
+/**
+ * GenerateData performs the accumulation of all the projections of the stack
+ * row by row so that each row of the volume is read and written once per
+ * stack instead of once per projection.
+ */
+template <class TInputImage, class TOutputImage>
+void
+FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
+  const OutputImageRegionType & outputRegionForThread)
+{
+  const unsigned int Dimension = TInputImage::ImageDimension;
+
+  // Iterators on volume input and output
+  using InputRegionIterator = itk::ImageRegionConstIterator<TInputImage>;
+  InputRegionIterator itIn(this->GetInput(), outputRegionForThread);
+  using OutputRegionIterator = itk::ImageRegionIterator<TOutputImage>;
+  OutputRegionIterator itOut(this->GetOutput(), outputRegionForThread);
+
+  // Initialize output region with input region in case the filter is not in
+  // place
+  if (this->GetInput() != this->GetOutput())
+  {
+    itIn.GoToBegin();
+    while (!itIn.IsAtEnd())
+    {
+      itOut.Set(itIn.Get());
+      ++itIn;
+      ++itOut;
+    }
+  }
+
+  // The output region is processed row by row along the first dimension
+  const typename OutputImageRegionType::IndexType outIndex = outputRegionForThread.GetIndex();
+  const typename OutputImageRegionType::SizeType  outSize = outputRegionForThread.GetSize();
+  typename TOutputImage::PixelType *              outBuffer = this->GetOutput()->GetBufferPointer();
+
+  // Go over each row
+  for (unsigned int k = 0; k < outSize[2]; k++)
+  {
+    for (unsigned int j = 0; j < outSize[1]; j++)
+    {
+      typename OutputImageRegionType::IndexType rowIndex = outIndex;
+      rowIndex[1] += j;
+      rowIndex[2] += k;
+      typename TOutputImage::PixelType * out = outBuffer + this->GetOutput()->ComputeOffset(rowIndex);
+
+      // Go over each projection while the row is in cache
+      for (const ProjectionCoefficients & coeffs : m_ProjectionCoefficients)
+      {
+        const ProjectionPixelType * projBuffer = coeffs.buffer;
+        const long * const          projSize = coeffs.size;
+        const long * const          projStride = coeffs.stride;
+
+        // Coefficients along the row, the projection indices are a linear function or
+        // a ratio of linear functions of the position n in the row
+        double numA[2], numB[2], denA, denB, distA, distB;
+        for (unsigned int i = 0; i < 2; i++)
         {
-          itOut.Set(itOut.Get() + interpolator->EvaluateAtContinuousIndex(pointProj));
+          numA[i] = coeffs.num[i][Dimension] + coeffs.num[i][0] * rowIndex[0] + coeffs.num[i][1] * rowIndex[1] +
+                    coeffs.num[i][2] * rowIndex[2];
+          numB[i] = coeffs.num[i][0];
         }
-      }
-      else // Cone-beam
-      {
-        // Compute projection index
-        for (unsigned int i = 0; i < Dimension - 1; i++)
+        denA = coeffs.den[Dimension] + coeffs.den[0] * rowIndex[0] + coeffs.den[1] * rowIndex[1] +
+               coeffs.den[2] * rowIndex[2];
+        denB = coeffs.den[0];
+        distA = coeffs.dist[Dimension] + coeffs.dist[0] * rowIndex[0] + coeffs.dist[1] * rowIndex[1] +
+                coeffs.dist[2] * rowIndex[2];
+        distB = coeffs.dist[0];
+
+        // Same test as itk::LinearInterpolateImageFunction::IsInsideBuffer, in front of the source
+        auto inside = [&](const long n) {
+          const double d = denA + denB * n;
+          if (!(d > 0.))
+            return false;
+          const double inv = 1. / d;
+          const double u0 = (numA[0] + numB[0] * n) * inv;
+          const double u1 = (numA[1] + numB[1] * n) * inv;
+          const double w = distA + distB * n;
+          return u0 >= -0.5 && u0 < projSize[0] - 0.5 && u1 >= -0.5 && u1 < projSize[1] - 0.5 && w >= -0.5 &&
+                 w < projSize[2] - 0.5;
+        };
+
+        // Clip the row to the voxels which project inside the buffer. Each
+        // condition is a + b n >= 0 with den > 0, the range is widened by one
+        // voxel and then shrunk with the exact test.
+        const double rowLength = outSize[0];
+        long         nFirst = 0, nLast = long(outSize[0]) - 1;
+        auto         clip = [&](const double a, const double b) {
+          if (b == 0.)
+          {
+            if (a < 0.)
+              nLast = -1;
+            return;
+          }
+          const double n = std::min(std::max(-a / b, -1.), rowLength); // Bounded before conversion
+          if (b > 0.)
+            nFirst = std::max(nFirst, long(std::ceil(n)) - 1);
+          else
+            nLast = std::min(nLast, long(std::floor(n)) + 1);
+        };
+        clip(denA, denB);
+        for (unsigned int i = 0; i < 2; i++)
         {
-          pointProj[i] = matrix[i][Dimension];
-          for (unsigned int j = 0; j < Dimension; j++)
-            pointProj[i] += matrix[i][j] * itOut.GetIndex()[j];
+          clip(numA[i] + 0.5 * denA, numB[i] + 0.5 * denB);
+          clip((projSize[i] - 0.5) * denA - numA[i], (projSize[i] - 0.5) * denB - numB[i]);
         }
+        clip(distA + 0.5, distB);
+        clip(projSize[2] - 0.5 - distA, -distB);
+        while (nFirst <= nLast && !inside(nFirst))
+          nFirst++;
+        while (nLast >= nFirst && !inside(nLast))
+          nLast--;
 
-        // Apply perspective
-        double perspFactor = matrix[Dimension - 1][Dimension];
-        for (unsigned int j = 0; j < Dimension; j++)
-          perspFactor += matrix[Dimension - 1][j] * itOut.GetIndex()[j];
-        perspFactor = 1 / perspFactor;
-        for (unsigned int i = 0; i < Dimension - 1; i++)
-          pointProj[i] = pointProj[i] * perspFactor;
-
-        // Distance driven
-        pointProj[Dimension - 1] = (sid / perspFactor - sid - m_ProjectionStack->GetOrigin()[Dimension - 1]) /
-                                   m_ProjectionStack->GetSpacing()[Dimension - 1];
-        // Interpolate if in projection
-        if (interpolator->IsInsideBuffer(pointProj))
+        // Trilinear interpolation on the raw buffer, clamped to the buffer
+        // as itk::LinearInterpolateImageFunction, and perspective weighting
+        for (long n = nFirst; n <= nLast; n++)
         {
-          itOut.Set(itOut.Get() + perspFactor * perspFactor * interpolator->EvaluateAtContinuousIndex(pointProj));
+          const double inv = 1. / (denA + denB * n);
+          const double u[3] = { std::min(std::max((numA[0] + numB[0] * n) * inv, 0.), projSize[0] - 1.),
+                                std::min(std::max((numA[1] + numB[1] * n) * inv, 0.), projSize[1] - 1.),
+                                std::min(std::max(distA + distB * n, 0.), projSize[2] - 1.) };
+          long   offset[3][2];
+          double f[3];
+          for (unsigned int i = 0; i < 3; i++)
+          {
+            const long i0 = long(u[i]);
+            f[i] = u[i] - i0;
+            offset[i][0] = i0 * projStride[i];
+            offset[i][1] = std::min(i0 + 1, projSize[i] - 1) * projStride[i];
+          }
+          double value = 0.;
+          for (unsigned int c = 0; c < 8; c++)
+          {
+            const unsigned int b0 = c & 1, b1 = (c >> 1) & 1, b2 = (c >> 2) & 1;
+            const double       weight = (b0 ? f[0] : 1. - f[0]) * (b1 ? f[1] : 1. - f[1]) * (b2 ? f[2] : 1. - f[2]);
+            value += weight * projBuffer[offset[0][b0] + offset[1][b1] + offset[2][b2]];
+          }
+          out[n] += inv * inv * value;
         }
       }
-
-      ++itOut;
     }
   }
 }
 
+template <class TInputImage, class TOutputImage>
+void
+FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::AfterThreadedGenerateData()
+{
+  // Release the views of the projections, or their copies if the pixel types
+  // differ, with the backprojection coefficients of each projection
+  m_ProjectionCoefficients.clear();
+}
+
 template <class TInputImage, class TOutputImage>
 typename FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::ProjectionImagePointer
 FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::GetDDProjection(const unsigned int iProj)
@@ -179,15 +296,21 @@ FDKDDBackProjectionImageFilter<TInputImage, TOutputImage>::GetDDProjection(const
   projection->SetSpacing(spacing);
   projection->SetOrigin(origin);
   projection->SetRegions(region);
-  projection->Allocate();
 
-  const unsigned int          npixels = projection->GetLargestPossibleRegion().GetNumberOfPixels();
-  const ProjectionPixelType * pi = m_ProjectionStack->GetBufferPointer() + (iProj - iProjBuff) * npixels;
-  ProjectionPixelType *       po = projection->GetBufferPointer();
-
-  // Transpose projection for optimization
-  for (unsigned int i = 0; i < npixels; i++)
-    *po++ = *pi++;
+  const unsigned int               npixels = projection->GetLargestPossibleRegion().GetNumberOfPixels();
+  ProjectionStackType::PixelType * pi = m_ProjectionStack->GetBufferPointer() + (iProj - iProjBuff) * npixels;
+  if constexpr (std::is_same<ProjectionPixelType, ProjectionStackType::PixelType>::value)
+  {
+    // Non-owning view of the projection in the buffer of the stack, valid as long as the stack
+    projection->GetPixelContainer()->SetImportPointer(pi, npixels, false);
+  }
+  else
+  {
+    projection->Allocate();
+    ProjectionPixelType * po = projection->GetBufferPointer();
+    for (unsigned int i = 0; i < npixels; i++)
+      *po++ = *pi++;
+  }
 
   return projection;
 }
@@ -8,6 +8,12 @@
 #include <itkExtractImageFilter.h>
 #include <itkTimeProbe.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 /** \class FDKDDConeBeamReconstructionFilter
  * TODO
  *  \ingroup PCT
@@ -65,6 +71,17 @@ public:
   itkGetMacro(ProjectionStack, ProjectionStackPointer);
   itkSetMacro(ProjectionStack, ProjectionStackPointer);
 
+  /** Get / Set the number of projections filtered and backprojected in one
+   * pass over the volume. Default is 16. */
+  itkGetMacro(ProjectionSubsetSize, unsigned int);
+  itkSetMacro(ProjectionSubsetSize, unsigned int);
+
+  /** Get / Set the maximum number of subsets of projections weighted and
+   * ramp filtered in a background thread ahead of the backprojection. Default
+   * is 0, each subset is filtered and then backprojected in sequence. */
+  itkGetMacro(NumberOfSubsetsAhead, unsigned int);
+  itkSetMacro(NumberOfSubsetsAhead, unsigned int);
+
 protected:
   FDKDDConeBeamReconstructionFilter();
   ~FDKDDConeBeamReconstructionFilter() {}
@@ -96,12 +113,20 @@ private:
   void
   operator=(const Self &);
 
+  /** Weight and ramp filter one subset of projections, the output is disconnected from the pipeline */
+  ProjectionStackPointer
+  FilterSubset(const typename ExtractFilterType::InputImageRegionType & subsetRegion);
+
   /** Probes to time reconstruction */
   itk::TimeProbe m_PreFilterProbe;
   itk::TimeProbe m_FilterProbe;
   itk::TimeProbe m_BackProjectionProbe;
+  itk::TimeProbe m_WaitProbe;
+  itk::TimeProbe m_TotalProbe;
 
   ProjectionStackPointer m_ProjectionStack;
+  unsigned int           m_ProjectionSubsetSize = 16;
+  unsigned int           m_NumberOfSubsetsAhead = 0;
 }; // end of class
 
 } // end namespace pct
@@ -45,12 +45,15 @@ FDKDDConeBeamReconstructionFilter<TInputImage, TOutputImage, TFFTPrecision>::Gen
 {
   const unsigned int Dimension = this->InputImageDimension;
 
+  if (m_ProjectionSubsetSize == 0)
+    itkExceptionMacro(<< "ProjectionSubsetSize must be at least 1.");
+
   // We only set the first sub-stack at that point, the rest will be
   // requested in the GenerateData function
   typename ExtractFilterType::InputImageRegionType projRegion;
   m_ProjectionStack->UpdateOutputInformation();
   projRegion = m_ProjectionStack->GetLargestPossibleRegion();
-  projRegion.SetSize(Dimension, 1);
+  projRegion.SetSize(Dimension, std::min(m_ProjectionSubsetSize, (unsigned int)projRegion.GetSize(Dimension)));
   m_ExtractFilter->SetExtractionRegion(projRegion);
 
   // Run composite filter update
@@ -71,43 +74,136 @@ FDKDDConeBeamReconstructionFilter<TInputImage, TOutputImage, TFFTPrecision>::Gen
 {
   const unsigned int Dimension = this->InputImageDimension;
 
+  m_TotalProbe.Start();
+
   // The backprojection works on a small stack of projections, not the full stack
-  typename ExtractFilterType::InputImageRegionType subsetRegion;
+  std::vector<typename ExtractFilterType::InputImageRegionType> subsetRegions;
+  typename ExtractFilterType::InputImageRegionType              subsetRegion;
   subsetRegion = m_ProjectionStack->GetLargestPossibleRegion();
-  unsigned int nProj = subsetRegion.GetSize(Dimension);
+  const int          iFirstProj = subsetRegion.GetIndex(Dimension);
+  const unsigned int nProj = subsetRegion.GetSize(Dimension);
+  for (unsigned int i = 0; i < nProj; i += m_ProjectionSubsetSize)
+  {
+    subsetRegion.SetIndex(Dimension, iFirstProj + i);
+    subsetRegion.SetSize(Dimension, std::min(m_ProjectionSubsetSize, nProj - i));
+    subsetRegions.push_back(subsetRegion);
+  }
+
+  // Producer of the filtered subsets in a background thread, at most
+  // m_NumberOfSubsetsAhead of them wait for the backprojection
+  std::deque<ProjectionStackPointer> filteredSubsets;
+  std::mutex                         mutex;
+  std::condition_variable            conditionVariable;
+  bool                               aborted = false;
+  std::exception_ptr                 exception;
+  std::thread                        producer;
+  if (m_NumberOfSubsetsAhead > 0)
+  {
+    producer = std::thread([&] {
+      try
+      {
+        for (const auto & region : subsetRegions)
+        {
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            conditionVariable.wait(lock,
+                                   [&] { return aborted || filteredSubsets.size() < m_NumberOfSubsetsAhead; });
+            if (aborted)
+              return;
+          }
+          ProjectionStackPointer subset = this->FilterSubset(region);
+
+          std::lock_guard<std::mutex> lock(mutex);
+          filteredSubsets.push_back(subset);
+          conditionVariable.notify_all();
+        }
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        exception = std::current_exception();
+        aborted = true;
+        conditionVariable.notify_all();
+      }
+    });
+  }
 
-  for (unsigned int i = 0; i < nProj; i++)
+  try
+  {
+    for (unsigned int s = 0; s < subsetRegions.size(); s++)
+    {
+      ProjectionStackPointer subset;
+      if (m_NumberOfSubsetsAhead > 0)
+      {
+        m_WaitProbe.Start();
+        std::unique_lock<std::mutex> lock(mutex);
+        conditionVariable.wait(lock, [&] { return aborted || !filteredSubsets.empty(); });
+        m_WaitProbe.Stop();
+        if (exception)
+          std::rethrow_exception(exception);
+        subset = filteredSubsets.front();
+        filteredSubsets.pop_front();
+        conditionVariable.notify_all();
+      }
+      else
+        subset = this->FilterSubset(subsetRegions[s]);
+
+      // After the first bp update, we need to use its output as input.
+      if (s)
+      {
+        typename TInputImage::Pointer pimg = m_BackProjectionFilter->GetOutput();
+        pimg->DisconnectPipeline();
+        m_BackProjectionFilter->SetInput(pimg);
+
+        // This is required to reset the full pipeline
+        m_BackProjectionFilter->GetOutput()->UpdateOutputInformation();
+        m_BackProjectionFilter->GetOutput()->PropagateRequestedRegion();
+      }
+      m_BackProjectionFilter->SetProjectionStack(subset);
+
+      m_BackProjectionProbe.Start();
+      m_BackProjectionFilter->Update();
+      m_BackProjectionProbe.Stop();
+    }
+  }
+  catch (...)
   {
-    // After the first bp update, we need to use its output as input.
-    if (i)
     {
-      typename TInputImage::Pointer pimg = m_BackProjectionFilter->GetOutput();
-      pimg->DisconnectPipeline();
-      m_BackProjectionFilter->SetInput(pimg);
-
-      // Change projection subset
-      subsetRegion.SetIndex(Dimension, i);
-      subsetRegion.SetSize(Dimension, 1);
-      m_ExtractFilter->SetExtractionRegion(subsetRegion);
-
-      // This is required to reset the full pipeline
-      m_BackProjectionFilter->GetOutput()->UpdateOutputInformation();
-      m_BackProjectionFilter->GetOutput()->PropagateRequestedRegion();
+      std::lock_guard<std::mutex> lock(mutex);
+      aborted = true;
+      conditionVariable.notify_all();
     }
+    if (producer.joinable())
+      producer.join();
+    throw;
+  }
+  if (producer.joinable())
+    producer.join();
 
-    m_PreFilterProbe.Start();
-    m_WeightFilter->UpdateLargestPossibleRegion();
-    m_PreFilterProbe.Stop();
+  Superclass::GraftOutput(m_BackProjectionFilter->GetOutput());
 
-    m_FilterProbe.Start();
-    m_RampFilter->UpdateLargestPossibleRegion();
-    m_FilterProbe.Stop();
+  m_TotalProbe.Stop();
+}
 
-    m_BackProjectionProbe.Start();
-    m_BackProjectionFilter->Update();
-    m_BackProjectionProbe.Stop();
-  }
-  Superclass::GraftOutput(m_BackProjectionFilter->GetOutput());
+template <class TInputImage, class TOutputImage, class TFFTPrecision>
+typename FDKDDConeBeamReconstructionFilter<TInputImage, TOutputImage, TFFTPrecision>::ProjectionStackPointer
+FDKDDConeBeamReconstructionFilter<TInputImage, TOutputImage, TFFTPrecision>::FilterSubset(
+  const typename ExtractFilterType::InputImageRegionType & subsetRegion)
+{
+  m_ExtractFilter->SetExtractionRegion(subsetRegion);
+
+  m_PreFilterProbe.Start();
+  m_WeightFilter->UpdateLargestPossibleRegion();
+  m_PreFilterProbe.Stop();
+
+  m_FilterProbe.Start();
+  m_RampFilter->UpdateLargestPossibleRegion();
+  m_FilterProbe.Stop();
+
+  // The ramp filter allocates a new output for the next subset
+  ProjectionStackPointer subset = m_RampFilter->GetOutput();
+  subset->DisconnectPipeline();
+  return subset;
 }
 
 template <class TInputImage, class TOutputImage, class TFFTPrecision>
@@ -139,6 +235,15 @@ FDKDDConeBeamReconstructionFilter<TInputImage, TOutputImage, TFFTPrecision>::Pri
   os << "  Prefilter operations: " << m_PreFilterProbe.GetTotal() << ' ' << m_PreFilterProbe.GetUnit() << std::endl;
   os << "  Ramp filter: " << m_FilterProbe.GetTotal() << ' ' << m_FilterProbe.GetUnit() << std::endl;
   os << "  Backprojection: " << m_BackProjectionProbe.GetTotal() << ' ' << m_BackProjectionProbe.GetUnit() << std::endl;
+  if (m_NumberOfSubsetsAhead > 0)
+  {
+    // Time of the filtering hidden behind the backprojection by the background thread
+    const double overlap = m_PreFilterProbe.GetTotal() + m_FilterProbe.GetTotal() +
+                           m_BackProjectionProbe.GetTotal() - m_TotalProbe.GetTotal();
+    os << "  Wait for filtered projections: " << m_WaitProbe.GetTotal() << ' ' << m_WaitProbe.GetUnit() << std::endl;
+    os << "  Overlap of filtering and backprojection: " << std::max(overlap, 0.) << ' ' << m_TotalProbe.GetUnit()
+       << std::endl;
+  }
 }
 
 } // end namespace pct
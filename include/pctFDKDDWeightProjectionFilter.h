@@ -16,6 +16,10 @@
  * SouceOffsets and ProjectionOffsets are accounted for on a per
  * projection basis but InPlaneRotation and OutOfPlaneRotation are not
  * accounted for.
+ * The 2D weights do not depend on the distance driven slice and are
+ * computed once per projection in a table. The tables can be cached across
+ * updates with CacheWeights as long as the geometry and the projection grid
+ * are not modified.
  * \author Simon Rit
  */
 namespace pct
@@ -46,6 +50,11 @@ public:
   itkGetMacro(Geometry, rtk::ThreeDCircularProjectionGeometry::Pointer);
   itkSetMacro(Geometry, rtk::ThreeDCircularProjectionGeometry::Pointer);
 
+  /** Get / Set whether the 2D weight tables are kept across updates. Default is off. */
+  itkGetMacro(CacheWeights, bool);
+  itkSetMacro(CacheWeights, bool);
+  itkBooleanMacro(CacheWeights);
+
 protected:
   FDKDDWeightProjectionFilter() {}
   ~FDKDDWeightProjectionFilter() {}
@@ -65,6 +74,14 @@ private:
 
   /** Geometrical description of the system */
   rtk::ThreeDCircularProjectionGeometry::Pointer m_Geometry;
+
+  /** 2D weight tables of each divergent projection (empty if not computed)
+   * and description of the geometry and of the projection grid they have been
+   * computed with */
+  std::vector<std::vector<float>> m_WeightTables;
+  itk::ModifiedTimeType           m_WeightTablesGeometryMTime = 0;
+  std::vector<double>             m_WeightTablesGrid;
+  bool                            m_CacheWeights = false;
 }; // end of class
 
 } // end namespace pct
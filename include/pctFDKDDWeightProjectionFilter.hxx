@@ -28,70 +28,125 @@ FDKDDWeightProjectionFilter<TInputImage, TOutputImage>::BeforeThreadedGenerateDa
       m_AngularWeightsAndRampFactor[k] *= rampFactor;
     }
   }
-}
 
-template <class TInputImage, class TOutputImage>
-void
-FDKDDWeightProjectionFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
-  const OutputImageRegionType & outputRegionForThread)
-{
+  // Description of the projection grid in the two first dimensions
+  const InputImageType *                      input = this->GetInput();
+  const typename InputImageType::RegionType & lpr = input->GetLargestPossibleRegion();
+  std::vector<double>                         grid;
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    grid.push_back(input->GetOrigin()[i]);
+    grid.push_back(input->GetSpacing()[i]);
+    grid.push_back(lpr.GetIndex(i));
+    grid.push_back(lpr.GetSize(i));
+  }
+
+  // Reset the tables if they are not cached or not valid anymore
+  if (!m_CacheWeights || m_WeightTablesGeometryMTime != m_Geometry->GetMTime() || m_WeightTablesGrid != grid ||
+      m_WeightTables.size() != m_AngularWeightsAndRampFactor.size())
+  {
+    m_WeightTables.clear();
+    m_WeightTables.resize(m_AngularWeightsAndRampFactor.size());
+    m_WeightTablesGeometryMTime = m_Geometry->GetMTime();
+    m_WeightTablesGrid = grid;
+  }
+
+  // Divergent projections of the requested region without weight table
+  const OutputImageRegionType & requested = this->GetOutput()->GetRequestedRegion();
+  std::vector<unsigned int>     missing;
+  for (unsigned int l = requested.GetIndex(3); l < requested.GetIndex(3) + requested.GetSize(3); l++)
+    if (m_Geometry->GetSourceToDetectorDistances()[l] != 0. && m_WeightTables[l].empty())
+      missing.push_back(l);
+  if (missing.empty())
+    return;
+
   // Prepare point increment (TransformIndexToPhysicalPoint too slow)
   typename InputImageType::PointType pointBase, pointIncrement;
-  typename InputImageType::IndexType index = outputRegionForThread.GetIndex();
-  this->GetInput()->TransformIndexToPhysicalPoint(index, pointBase);
+  typename InputImageType::IndexType index = lpr.GetIndex();
+  input->TransformIndexToPhysicalPoint(index, pointBase);
   for (int i = 0; i < 3; i++)
     index[i]++;
-  this->GetInput()->TransformIndexToPhysicalPoint(index, pointIncrement);
+  input->TransformIndexToPhysicalPoint(index, pointIncrement);
   for (int i = 0; i < 3; i++)
     pointIncrement[i] -= pointBase[i];
 
-  // Iterators
-  using InputConstIterator = itk::ImageRegionConstIterator<InputImageType>;
-  InputConstIterator itI(this->GetInput(), outputRegionForThread);
-  using OutputIterator = itk::ImageRegionIterator<OutputImageType>;
-  OutputIterator itO(this->GetOutput(), outputRegionForThread);
-  itI.GoToBegin();
-  itO.GoToBegin();
+  const unsigned int nu = lpr.GetSize(0);
+  const unsigned int nv = lpr.GetSize(1);
+  this->GetMultiThreader()->ParallelizeArray(
+    0,
+    missing.size(),
+    [&](itk::SizeValueType m) {
+      const unsigned int l = missing[m];
+      const double       sdd = m_Geometry->GetSourceToDetectorDistances()[l];
+      const double       sid = m_Geometry->GetSourceToIsocenterDistances()[l];
+      const double       sdd2 = sdd * sdd;
+      const double       sourceOffsetX = m_Geometry->GetSourceOffsetsX()[l];
+      const double       sourceOffsetY = m_Geometry->GetSourceOffsetsY()[l];
+      const double       tauOverDw = m_AngularWeightsAndRampFactor[l] * sourceOffsetX / sid;
+      const double       sddw = m_AngularWeightsAndRampFactor[l] * sdd;
+      const double       x0 = pointBase[0] + m_Geometry->GetProjectionOffsetsX()[l] - sourceOffsetX;
+      const double       y0 = pointBase[1] + m_Geometry->GetProjectionOffsetsY()[l] - sourceOffsetY;
 
-  // Go over output, compute weights and avoid redundant computation
+      std::vector<float> table(nu * nv);
+      for (unsigned int j = 0; j < nv; j++)
+      {
+        const double y = y0 + j * pointIncrement[1];
+        const double sdd2y2 = sdd2 + y * y;
+        for (unsigned int i = 0; i < nu; i++)
+        {
+          // The term between parentheses comes from the publication
+          // [Gullberg Crawford Tsui, TMI, 1986], equation 18
+          const double x = x0 + i * pointIncrement[0];
+          table[j * nu + i] = (sddw - tauOverDw * x) / sqrt(sdd2y2 + x * x);
+        }
+      }
+      m_WeightTables[l].swap(table);
+    },
+    nullptr);
+}
+
+template <class TInputImage, class TOutputImage>
+void
+FDKDDWeightProjectionFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
+  const OutputImageRegionType & outputRegionForThread)
+{
+  const InputImageType *                     input = this->GetInput();
+  OutputImageType *                          output = this->GetOutput();
+  const typename InputImageType::IndexType & lprIndex = input->GetLargestPossibleRegion().GetIndex();
+  const unsigned int                         nu = input->GetLargestPossibleRegion().GetSize(0);
+  const unsigned int                         rowLength = outputRegionForThread.GetSize(0);
+
+  // Go over output row by row, the 2D weights of a row are shared by all the
+  // distance driven slices
+  typename OutputImageRegionType::IndexType rowIndex = outputRegionForThread.GetIndex();
   for (unsigned int l = outputRegionForThread.GetIndex(3);
        l < outputRegionForThread.GetIndex(3) + outputRegionForThread.GetSize(3);
        l++)
   {
+    rowIndex[3] = l;
     for (unsigned int k = outputRegionForThread.GetIndex(2);
          k < outputRegionForThread.GetIndex(2) + outputRegionForThread.GetSize(2);
          k++)
     {
-      typename InputImageType::PointType point = pointBase;
-      point[1] = pointBase[1] + m_Geometry->GetProjectionOffsetsY()[l] - m_Geometry->GetSourceOffsetsY()[l];
-      const double sdd = m_Geometry->GetSourceToDetectorDistances()[l];
-      const double sid = m_Geometry->GetSourceToIsocenterDistances()[l];
-      const double sdd2 = sdd * sdd;
-      if (sdd != 0.) // Divergent
+      rowIndex[2] = k;
+      for (unsigned int j = outputRegionForThread.GetIndex(1);
+           j < outputRegionForThread.GetIndex(1) + outputRegionForThread.GetSize(1);
+           j++)
       {
-        const double tauOverD = m_Geometry->GetSourceOffsetsX()[l] / sid;
-        const double tauOverDw = m_AngularWeightsAndRampFactor[l] * tauOverD;
-        const double sddw = m_AngularWeightsAndRampFactor[l] * sdd;
-        for (unsigned int j = 0; j < outputRegionForThread.GetSize(1); j++, point[1] += pointIncrement[1])
+        rowIndex[1] = j;
+        const typename InputImageType::PixelType * in = input->GetBufferPointer() + input->ComputeOffset(rowIndex);
+        typename OutputImageType::PixelType *      out = output->GetBufferPointer() + output->ComputeOffset(rowIndex);
+        if (m_Geometry->GetSourceToDetectorDistances()[l] != 0.) // Divergent
         {
-          point[0] = pointBase[0] + m_Geometry->GetProjectionOffsetsX()[l] - m_Geometry->GetSourceOffsetsX()[l];
-          const double sdd2y2 = sdd2 + point[1] * point[1];
-          for (unsigned int i = 0; i < outputRegionForThread.GetSize(0);
-               i++, ++itI, ++itO, point[0] += pointIncrement[0])
-          {
-            // The term between parentheses comes from the publication
-            // [Gullberg Crawford Tsui, TMI, 1986], equation 18
-            itO.Set(itI.Get() * (sddw - tauOverDw * point[0]) / sqrt(sdd2y2 + point[0] * point[0]));
-          }
+          const float * weights = m_WeightTables[l].data() + (j - lprIndex[1]) * nu + (rowIndex[0] - lprIndex[0]);
+          for (unsigned int i = 0; i < rowLength; i++)
+            out[i] = in[i] * weights[i];
         }
-      }
-      else // Parallel
-      {
-        double weight = m_AngularWeightsAndRampFactor[l];
-        for (unsigned int j = 0; j < outputRegionForThread.GetSize(1); j++)
+        else // Parallel
         {
-          for (unsigned int i = 0; i < outputRegionForThread.GetSize(0); i++, ++itI, ++itO)
-            itO.Set(itI.Get() * weight);
+          const double weight = m_AngularWeightsAndRampFactor[l];
+          for (unsigned int i = 0; i < rowLength; i++)
+            out[i] = in[i] * weight;
         }
       }
     }
@@ -0,0 +1,79 @@
+#ifndef __pctHoleFillingImageFilter_h
+#define __pctHoleFillingImageFilter_h
+
+#include <itkInPlaceImageFilter.h>
+
+/** \class HoleFillingImageFilter
+ * \ingroup PCT
+ * Fills the pixels equal to HolePixel with the average of their non-hole
+ * neighbors in the 3^Dimension neighborhood, layer by layer from the known
+ * pixels inwards. The filter keeps a queue of the holes at the frontier of
+ * the known pixels instead of scanning the whole image at each layer, so the
+ * cost depends on the number of holes.
+ * In 3D, the layers and the averaging are those of SmallHoleFiller. In other
+ * dimensions, the results differ: SmallHoleFiller uses a hardcoded stencil of
+ * the first 27 pixels of the neighborhood, skipping pixel 13 as the center.
+ * In 4D, it only averages the 26 pixels around the previous index along the
+ * fourth dimension, whereas this filter averages the 80 neighbors.
+ * Each layer is processed with multiple threads. Holes which are not
+ * connected to any known pixel are left unchanged.
+ *
+ * \author Simon Rit
+ */
+namespace pct
+{
+
+template <class TImage>
+class ITK_TEMPLATE_EXPORT HoleFillingImageFilter : public itk::InPlaceImageFilter<TImage, TImage>
+{
+public:
+  /** Standard class typedefs. */
+  using Self = HoleFillingImageFilter;
+  using Superclass = itk::InPlaceImageFilter<TImage, TImage>;
+  using Pointer = itk::SmartPointer<Self>;
+  using ConstPointer = itk::SmartPointer<const Self>;
+
+  /** Some convenient typedefs. */
+  using ImageType = TImage;
+  using PixelType = typename TImage::PixelType;
+
+  /** Standard New method. */
+  itkNewMacro(Self);
+
+  /** Runtime information support. */
+  itkOverrideGetNameOfClassMacro(HoleFillingImageFilter);
+
+  /** Get / Set the value of the pixels to fill. Default is 0. */
+  itkGetMacro(HolePixel, PixelType);
+  itkSetMacro(HolePixel, PixelType);
+
+  /** Number of layers of holes filled by the last update */
+  itkGetConstMacro(NumberOfLayers, unsigned int);
+
+protected:
+  HoleFillingImageFilter();
+  ~HoleFillingImageFilter() {}
+
+  /** The holes depend on the whole image */
+  void
+  EnlargeOutputRequestedRegion(itk::DataObject * output) override;
+
+  void
+  GenerateData() override;
+
+private:
+  HoleFillingImageFilter(const Self &); // purposely not implemented
+  void
+  operator=(const Self &); // purposely not implemented
+
+  PixelType    m_HolePixel;
+  unsigned int m_NumberOfLayers = 0;
+}; // end of class
+
+} // end namespace pct
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "pctHoleFillingImageFilter.hxx"
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef __pctHoleFillingImageFilter_hxx
+#define __pctHoleFillingImageFilter_hxx
+
+#include <itkImageAlgorithm.h>
+#include <itkNumericTraits.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace pct
+{
+
+template <class TImage>
+HoleFillingImageFilter<TImage>::HoleFillingImageFilter()
+{
+  m_HolePixel = itk::NumericTraits<PixelType>::ZeroValue();
+  this->SetInPlace(true);
+}
+
+template <class TImage>
+void
+HoleFillingImageFilter<TImage>::EnlargeOutputRequestedRegion(itk::DataObject * output)
+{
+  Superclass::EnlargeOutputRequestedRegion(output);
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template <class TImage>
+void
+HoleFillingImageFilter<TImage>::GenerateData()
+{
+  const unsigned int Dimension = TImage::ImageDimension;
+
+  this->AllocateOutputs();
+  TImage *                            output = this->GetOutput();
+  const typename TImage::RegionType & region = output->GetBufferedRegion();
+  if (!this->GetRunningInPlace())
+    itk::ImageAlgorithm::Copy(this->GetInput(), output, region, region);
+
+  PixelType *                  buffer = output->GetBufferPointer();
+  const itk::OffsetValueType   npix = region.GetNumberOfPixels();
+  const itk::OffsetValueType * strides = output->GetOffsetTable();
+  long                         size[Dimension];
+  for (unsigned int d = 0; d < Dimension; d++)
+    size[d] = region.GetSize(d);
+
+  // Offsets of the neighbors in the 3^Dimension neighborhood, without the center
+  std::vector<itk::Offset<Dimension>> neighbors;
+  std::vector<itk::OffsetValueType>   neighborOffsets;
+  unsigned int                        nNeighborhood = 1;
+  for (unsigned int d = 0; d < Dimension; d++)
+    nNeighborhood *= 3;
+  for (unsigned int c = 0; c < nNeighborhood; c++)
+  {
+    itk::Offset<Dimension> o;
+    itk::OffsetValueType   offset = 0;
+    bool                   center = true;
+    for (unsigned int d = 0, code = c; d < Dimension; d++, code /= 3)
+    {
+      o[d] = long(code % 3) - 1;
+      offset += o[d] * strides[d];
+      center = center && o[d] == 0;
+    }
+    if (center)
+      continue;
+    neighbors.push_back(o);
+    neighborOffsets.push_back(offset);
+  }
+
+  // Calls f with the buffer offset of each neighbor of pixel n inside the buffer
+  auto forEachNeighbor = [&](const itk::OffsetValueType n, auto && f) {
+    long                 index[Dimension];
+    itk::OffsetValueType r = n;
+    bool                 interior = true;
+    for (unsigned int d = 0; d < Dimension; d++)
+    {
+      index[d] = r % size[d];
+      r /= size[d];
+      interior = interior && index[d] > 0 && index[d] < size[d] - 1;
+    }
+    for (unsigned int i = 0; i < neighbors.size(); i++)
+    {
+      bool inside = interior;
+      if (!interior)
+      {
+        inside = true;
+        for (unsigned int d = 0; d < Dimension && inside; d++)
+          inside = index[d] + neighbors[i][d] >= 0 && index[d] + neighbors[i][d] < size[d];
+      }
+      if (inside)
+        f(n + neighborOffsets[i]);
+    }
+  };
+
+  // State of each pixel. The holes in the frontier are queued once.
+  enum : unsigned char
+  {
+    Hole = 0,
+    Queued = 1,
+    Known = 2
+  };
+  std::vector<std::atomic<unsigned char>> state(npix);
+
+  // Calls f(i, b) for each i in [0, n) with b the block of i, the blocks being processed in parallel
+  const itk::SizeValueType blockSize = 4096;
+  auto                     parallelizeBlocks = [&](const itk::SizeValueType n, auto && f) {
+    this->GetMultiThreader()->ParallelizeArray(
+      0,
+      (n + blockSize - 1) / blockSize,
+      [&](itk::SizeValueType b) {
+        for (itk::SizeValueType i = b * blockSize; i < std::min(n, (b + 1) * blockSize); i++)
+          f(i, b);
+      },
+      nullptr);
+  };
+
+  // Same for the pixels added to the next frontier, each block gathers them in
+  // its own list and the lists are concatenated in block order
+  std::vector<std::vector<itk::OffsetValueType>> blockFrontiers;
+  std::vector<itk::OffsetValueType>              frontier;
+
+  auto gatherFrontier = [&](const itk::SizeValueType n, auto && f) {
+    blockFrontiers.assign((n + blockSize - 1) / blockSize, std::vector<itk::OffsetValueType>());
+    parallelizeBlocks(n, [&](const itk::SizeValueType i, const itk::SizeValueType b) { f(i, blockFrontiers[b]); });
+    frontier.clear();
+    for (const auto & blockFrontier : blockFrontiers)
+      frontier.insert(frontier.end(), blockFrontier.begin(), blockFrontier.end());
+  };
+
+  // Known pixels and holes
+  parallelizeBlocks(npix, [&](const itk::SizeValueType n, itk::SizeValueType) {
+    state[n].store((buffer[n] == m_HolePixel) ? Hole : Known, std::memory_order_relaxed);
+  });
+
+  // First frontier: the holes with a known neighbor
+  gatherFrontier(npix, [&](const itk::SizeValueType n, std::vector<itk::OffsetValueType> & next) {
+    if (state[n].load(std::memory_order_relaxed) != Hole)
+      return;
+    bool hasKnownNeighbor = false;
+    forEachNeighbor(n, [&](const itk::OffsetValueType m) {
+      hasKnownNeighbor = hasKnownNeighbor || state[m].load(std::memory_order_relaxed) == Known;
+    });
+    if (hasKnownNeighbor)
+      next.push_back(n);
+  });
+  for (const itk::OffsetValueType n : frontier)
+    state[n].store(Queued, std::memory_order_relaxed);
+
+  // Fill layer by layer
+  std::vector<PixelType> values;
+  m_NumberOfLayers = 0;
+  while (!frontier.empty())
+  {
+    m_NumberOfLayers++;
+
+    // Average of the neighbors known before this layer
+    values.resize(frontier.size());
+    parallelizeBlocks(frontier.size(), [&](const itk::SizeValueType f, itk::SizeValueType) {
+      PixelType    pixelSum = itk::NumericTraits<PixelType>::ZeroValue();
+      unsigned int validPixels = 0;
+      forEachNeighbor(frontier[f], [&](const itk::OffsetValueType m) {
+        if (state[m].load(std::memory_order_relaxed) == Known)
+        {
+          validPixels++;
+          pixelSum += buffer[m];
+        }
+      });
+      // We multiply by the reciprocal because operator/ is not defined for all types.
+      values[f] = static_cast<PixelType>(pixelSum * (1.0 / validPixels));
+    });
+
+    // Set the layer and mark it as known
+    parallelizeBlocks(frontier.size(), [&](const itk::SizeValueType f, itk::SizeValueType) {
+      buffer[frontier[f]] = values[f];
+      state[frontier[f]].store(Known, std::memory_order_relaxed);
+    });
+
+    // Next frontier: the holes next to this layer, claimed by the first block reaching them
+    const std::vector<itk::OffsetValueType> layer = std::move(frontier);
+    gatherFrontier(layer.size(), [&](const itk::SizeValueType f, std::vector<itk::OffsetValueType> & next) {
+      forEachNeighbor(layer[f], [&](const itk::OffsetValueType m) {
+        unsigned char expected = Hole;
+        if (state[m].load(std::memory_order_relaxed) == Hole &&
+            state[m].compare_exchange_strong(expected, Queued, std::memory_order_relaxed))
+          next.push_back(m);
+      });
+    });
+  }
+}
+
+} // end namespace pct
+
+#endif
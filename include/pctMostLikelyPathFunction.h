@@ -72,12 +72,25 @@ public:
     itkGenericExceptionMacro("Not implemented in the derived class.");
   }
 
-  /** Vectorised version of the above method. Implement dummy in derived class if not applicable for the type of MLP */
-  // NK: maybe explicit <double> should be replaced with <TCoordRep>
+  /** Evaluate the coordinates (x[i],y[i]) at the n depths u[i]. The output
+   * buffers are provided by the caller and must hold n values so that no
+   * memory is allocated. The default implementation calls the scalar version
+   * for each depth, derived classes override it when they can do better. */
   virtual void
-  Evaluate(std::vector<double> u, std::vector<double> & x, std::vector<double> & y)
+  Evaluate(const TCoordRep * u, const size_t n, TCoordRep * x, TCoordRep * y)
   {
-    itkGenericExceptionMacro("Not implemented in the derived class.");
+    TCoordRep dx, dy;
+    for (size_t i = 0; i < n; i++)
+      this->Evaluate(u[i], x[i], y[i], dx, dy);
+  }
+
+  /** Vectorised version of the scalar method, x and y are resized to the size of u. */
+  void
+  Evaluate(const std::vector<TCoordRep> & u, std::vector<TCoordRep> & x, std::vector<TCoordRep> & y)
+  {
+    x.resize(u.size());
+    y.resize(u.size());
+    this->Evaluate(u.data(), u.size(), x.data(), y.data());
   }
 
   bool m_CanBeVectorised = false;
@@ -0,0 +1,137 @@
+#ifndef __pctP2QuantileEstimator_h
+#define __pctP2QuantileEstimator_h
+
+#include <algorithm>
+#include <cmath>
+
+namespace pct
+{
+
+/** \class P2QuantileEstimator
+ * \brief Streaming estimation of a quantile with the P² algorithm.
+ *
+ * The estimator keeps five markers whose heights approximate the minimum,
+ * the p/2, p, (1+p)/2 quantiles and the maximum of the observations, see
+ * [Jain and Chlamtac, Commun ACM, 1985]. The memory is fixed whatever the
+ * number of observations. The five first observations are kept exactly.
+ *
+ * \ingroup PCT
+ */
+class P2QuantileEstimator
+{
+public:
+  P2QuantileEstimator(const double p = 0.5)
+    : m_P(p)
+  {}
+
+  /** Add an observation. */
+  void
+  Add(const double x)
+  {
+    if (m_Count < 5)
+    {
+      // Observations are kept in their order of arrival until the markers are initialized
+      m_Heights[m_Count++] = x;
+      if (m_Count == 5)
+      {
+        std::sort(m_Heights, m_Heights + 5);
+        for (int i = 0; i < 5; i++)
+          m_Positions[i] = i;
+      }
+      return;
+    }
+
+    // Cell k of the new observation, the extreme markers are moved if needed
+    int k;
+    if (x < m_Heights[0])
+    {
+      m_Heights[0] = x;
+      k = 0;
+    }
+    else if (x >= m_Heights[4])
+    {
+      m_Heights[4] = x;
+      k = 3;
+    }
+    else
+    {
+      k = 0;
+      while (x >= m_Heights[k + 1])
+        k++;
+    }
+    for (int i = k + 1; i < 5; i++)
+      m_Positions[i]++;
+    m_Count++;
+
+    // Adjust the heights of the three middle markers if they are off their desired positions
+    const double increments[5] = { 0., 0.5 * m_P, m_P, 0.5 * (1. + m_P), 1. };
+    for (int i = 1; i < 4; i++)
+    {
+      const double d = increments[i] * (m_Count - 1) - m_Positions[i];
+      if ((d >= 1. && m_Positions[i + 1] - m_Positions[i] > 1) ||
+          (d <= -1. && m_Positions[i - 1] - m_Positions[i] < -1))
+      {
+        const int    s = (d > 0.) ? 1 : -1;
+        const double qp = Parabolic(i, s);
+        if (m_Heights[i - 1] < qp && qp < m_Heights[i + 1])
+          m_Heights[i] = qp;
+        else
+          m_Heights[i] += s * (m_Heights[i + s] - m_Heights[i]) / (m_Positions[i + s] - m_Positions[i]);
+        m_Positions[i] += s;
+      }
+    }
+  }
+
+  /** Number of observations. */
+  unsigned int
+  GetCount() const
+  {
+    return m_Count;
+  }
+
+  /** Observation #i in order of arrival, only available for i < GetCount() < 5. */
+  double
+  GetObservation(const unsigned int i) const
+  {
+    return m_Heights[i];
+  }
+
+  /** Estimated quantile. With 5 observations or less, it is computed exactly
+   * with a linear interpolation between the sorted observations of rank
+   * ceil(n p) and ceil(n p) - 1 (starting from 0). */
+  double
+  GetQuantile() const
+  {
+    if (m_Count > 5)
+      return m_Heights[2];
+    if (m_Count < 2)
+      return (m_Count) ? m_Heights[0] : 0.;
+    double sorted[5];
+    std::copy(m_Heights, m_Heights + m_Count, sorted);
+    std::sort(sorted, sorted + m_Count);
+    const double       pos = m_Count * m_P;
+    const unsigned int supPos = std::min((unsigned int)std::ceil(pos), m_Count - 1);
+    const double       diff = supPos - pos;
+    return sorted[supPos] * (1. - diff) + sorted[supPos - 1] * diff;
+  }
+
+private:
+  /** Piecewise parabolic prediction of the height of marker i moved by s */
+  double
+  Parabolic(const int i, const int s) const
+  {
+    const double nm = m_Positions[i - 1], n = m_Positions[i], np = m_Positions[i + 1];
+    return m_Heights[i] + s / (np - nm) *
+                            ((n - nm + s) * (m_Heights[i + 1] - m_Heights[i]) / (np - n) +
+                             (np - n - s) * (m_Heights[i] - m_Heights[i - 1]) / (n - nm));
+  }
+
+  double       m_P;
+  double       m_Heights[5] = { 0., 0., 0., 0., 0. };
+  int          m_Positions[5] = { 0, 0, 0, 0, 0 };
+  unsigned int m_Count = 0;
+};
+
+} // end namespace pct
+
+#endif
@@ -156,8 +156,131 @@ public:
   Init(const VectorType posIn, const VectorType posOut, const VectorType dirIn, const VectorType dirOut) override;
 
   /* Vectorised version of Evaluate function. */
+  using Superclass::Evaluate;
   virtual void
-  Evaluate(std::vector<double> u, std::vector<double> & x, std::vector<double> & y) override;
+  Evaluate(const double * u, const size_t n, double * x, double * y) override;
+
+  /** Same as the vectorised Evaluate with the polynomial degree known at
+   * compile time, which must be the one set with SetPolynomialDegree, so that
+   * the Horner scheme is unrolled. */
+  template <int VPolynomialDegree>
+  void
+  EvaluateWithDegree(const double * u, const size_t n, double * x, double * y) const
+  {
+    for (size_t j = 0; j < n; j++)
+    {
+      const double uj = u[j] - m_uOrigin;
+      double       xj = 0.;
+      double       yj = 0.;
+      for (int i = VPolynomialDegree + 3; i > 0; i--)
+      {
+        xj = (xj + m_dm_x[i]) * uj;
+        yj = (yj + m_dm_y[i]) * uj;
+      }
+      x[j] = xj + m_dm_x[0];
+      y[j] = yj + m_dm_y[0];
+    }
+  }
+
+  /** Coefficients of the MLP of VLanes protons in structure-of-arrays
+   * layout for cross-proton vectorisation, see InitBatch. */
+  template <unsigned int VLanes>
+  struct BatchCoefficients
+  {
+    double uOrigin[VLanes];
+    double dm_x[9][VLanes];
+    double dm_y[9][VLanes];
+  };
+
+  /** Same as Init for VLanes protons at once. The positions and the
+   * directions, normalized to z, are in structure-of-arrays layout and each
+   * step is done for all lanes in lock-step. */
+  template <unsigned int VLanes>
+  void
+  InitBatch(const double                 posIn[3][VLanes],
+            const double                 posOut[3][VLanes],
+            const double                 dirIn[2][VLanes],
+            const double                 dirOut[2][VLanes],
+            BatchCoefficients<VLanes> & coeffs) const
+  {
+    // Factors A, B, C and D, see Functor::PolynomialMLP::FactorsABCD
+    double u2[VLanes], A[VLanes], B[VLanes], C[VLanes], D[VLanes], power[VLanes];
+    for (unsigned int l = 0; l < VLanes; l++)
+    {
+      coeffs.uOrigin[l] = posIn[2][l];
+      u2[l] = posOut[2][l] - posIn[2][l];
+      A[l] = B[l] = C[l] = D[l] = 0.;
+      power[l] = u2[l];
+    }
+    for (unsigned int i = 0; i < m_bm.size(); i++)
+    {
+      const double bmA = m_bm[i] / (i + 1);
+      const double bmB = m_bm[i] / (i + 2);
+      const double bmC = m_bm[i] / (i + 1) / (i + 2);
+      const double bmD = m_bm[i] / (i + 2) / (i + 3);
+      for (unsigned int l = 0; l < VLanes; l++)
+      {
+        A[l] += bmA * power[l];
+        B[l] += bmB * power[l] * u2[l];
+        C[l] += bmC * power[l] * u2[l];
+        D[l] += bmD * power[l] * u2[l] * u2[l];
+        power[l] *= u2[l];
+      }
+    }
+
+    // Coefficients c0 and c1 (see Functor::PolynomialMLP::CoefficientsC) and dm, in x then y
+    for (unsigned int d = 0; d < 2; d++)
+    {
+      double(&dm)[9][VLanes] = (d == 0) ? coeffs.dm_x : coeffs.dm_y;
+      double c0[VLanes], c1[VLanes];
+      for (unsigned int l = 0; l < VLanes; l++)
+      {
+        const double theta0 = std::atan(dirIn[d][l]);
+        const double theta2 = std::atan(dirOut[d][l]);
+        const double dPos = posOut[d][l] - posIn[d][l] - theta0 * u2[l];
+        const double dTheta = theta2 - theta0;
+        const double invDet = 1. / (A[l] * D[l] - B[l] * C[l]);
+        c0[l] = (-B[l] * dPos + D[l] * dTheta) * invDet;
+        c1[l] = (A[l] * dPos - C[l] * dTheta) * invDet;
+        dm[0][l] = posIn[d][l];
+        dm[1][l] = theta0;
+        dm[2][l] = c0[l] * m_bm[0] / 2;
+      }
+      for (int i = 3; i != m_PolynomialDegree + 3; i++)
+        for (unsigned int l = 0; l < VLanes; l++)
+          dm[i][l] = (c0[l] * m_bm[i - 2] + c1[l] * m_bm[i - 3]) / i / (i - 1);
+      for (unsigned int l = 0; l < VLanes; l++)
+        dm[m_PolynomialDegree + 3][l] =
+          c1[l] * m_bm[m_PolynomialDegree] / (m_PolynomialDegree + 2) / (m_PolynomialDegree + 3);
+    }
+  }
+
+  /** Same as EvaluateWithDegree at depth u for the VLanes protons of coeffs. */
+  template <int VPolynomialDegree, unsigned int VLanes>
+  static void
+  EvaluateBatch(const BatchCoefficients<VLanes> & coeffs, const double u, double * x, double * y)
+  {
+    double uu[VLanes];
+    for (unsigned int l = 0; l < VLanes; l++)
+    {
+      uu[l] = u - coeffs.uOrigin[l];
+      x[l] = 0.;
+      y[l] = 0.;
+    }
+    for (int i = VPolynomialDegree + 3; i > 0; i--)
+    {
+      for (unsigned int l = 0; l < VLanes; l++)
+      {
+        x[l] = (x[l] + coeffs.dm_x[i][l]) * uu[l];
+        y[l] = (y[l] + coeffs.dm_y[i][l]) * uu[l];
+      }
+    }
+    for (unsigned int l = 0; l < VLanes; l++)
+    {
+      x[l] += coeffs.dm_x[0][l];
+      y[l] += coeffs.dm_y[0][l];
+    }
+  }
 
   /** Evaluate the error (x,y) (equation 27) at depth z. */
   void
@@ -0,0 +1,140 @@
+#ifndef __pctProtonPairsChunkReader_h
+#define __pctProtonPairsChunkReader_h
+
+#include "PCTExport.h"
+
+#include <itkImage.h>
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace pct
+{
+
+/** \class ProtonPairsChunkReader
+ * \brief Reads a file of proton pairs by chunks of a bounded number of pairs.
+ *
+ * The chunks are read in order in a background thread while the chunks
+ * already in memory are processed. At most NumberOfChunksInFlight chunks are
+ * in memory at a time so that the memory footprint does not depend on the
+ * number of pairs in the file. A chunk is freed once all its pairs have been
+ * released with ReleasePairs, whichever consumers processed them, so that
+ * the consumers do not need to run concurrently.
+ *
+ * \ingroup PCT
+ */
+class PCT_EXPORT ProtonPairsChunkReader : public itk::Object
+{
+public:
+  /** Standard class typedefs. */
+  using Self = ProtonPairsChunkReader;
+  using Superclass = itk::Object;
+  using Pointer = itk::SmartPointer<Self>;
+  using ConstPointer = itk::SmartPointer<const Self>;
+
+  using ProtonPairsPixelType = itk::Vector<float, 3>;
+  using ProtonPairsImageType = itk::Image<ProtonPairsPixelType, 2>;
+  using ProtonPairsImagePointer = ProtonPairsImageType::Pointer;
+  using RegionType = ProtonPairsImageType::RegionType;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkOverrideGetNameOfClassMacro(ProtonPairsChunkReader);
+
+  /** Get/Set the file of proton pairs. */
+  itkGetMacro(FileName, std::string);
+  itkSetMacro(FileName, std::string);
+
+  /** Get/Set the maximum number of pairs per chunk. 0 reads the file in a single chunk. */
+  itkGetMacro(NumberOfPairsPerChunk, itk::SizeValueType);
+  itkSetMacro(NumberOfPairsPerChunk, itk::SizeValueType);
+
+  /** Get/Set the maximum number of chunks in memory, including the one being read. Default is 2. */
+  itkGetMacro(NumberOfChunksInFlight, unsigned int);
+  itkSetMacro(NumberOfChunksInFlight, unsigned int);
+
+  /** Read the file information, split the pairs in chunks and start reading them in the background. */
+  void
+  Start();
+
+  /** Wake up the threads waiting for a chunk. GetChunk returns a null pointer after this call. */
+  void
+  Abort();
+
+  /** Abort and wait for the background thread. */
+  void
+  Stop();
+
+  /** Largest possible region of the file, available after Start. */
+  const RegionType &
+  GetLargestPossibleRegion() const
+  {
+    return m_LargestPossibleRegion;
+  }
+
+  /** Number of chunks and region of each of them in the file, available after Start. */
+  unsigned int
+  GetNumberOfChunks() const
+  {
+    return m_ChunkRegions.size();
+  }
+  const RegionType &
+  GetChunkRegion(const unsigned int i) const
+  {
+    return m_ChunkRegions[i];
+  }
+
+  /** Wait until chunk i is in memory and return it. The buffered region of
+   * the chunk is GetChunkRegion(i). Returns a null pointer if reading has
+   * been aborted and rethrows the exception of the background thread if
+   * reading has failed. */
+  ProtonPairsImagePointer
+  GetChunk(const unsigned int i);
+
+  /** Must be called when n pairs of chunk i have been processed. The chunk is
+   * freed when all its pairs have been released. A consumer must not call
+   * GetChunk(i) after all the pairs of chunk i have been released. */
+  void
+  ReleasePairs(const unsigned int i, const itk::SizeValueType n);
+
+protected:
+  ProtonPairsChunkReader() {}
+  ~ProtonPairsChunkReader() override;
+
+  /** Main function of the background thread. */
+  void
+  ReadChunks();
+
+private:
+  ProtonPairsChunkReader(const Self &); // purposely not implemented
+  void
+  operator=(const Self &); // purposely not implemented
+
+  std::string        m_FileName;
+  itk::SizeValueType m_NumberOfPairsPerChunk = 1000000;
+  unsigned int       m_NumberOfChunksInFlight = 2;
+
+  RegionType                           m_LargestPossibleRegion;
+  std::vector<RegionType>              m_ChunkRegions;
+  std::vector<ProtonPairsImagePointer> m_Chunks;
+  std::vector<itk::SizeValueType>      m_NumberOfPendingPairs;
+
+  /** Synchronization with the background thread, m_Mutex protects all members below. */
+  std::thread             m_Thread;
+  std::mutex              m_Mutex;
+  std::condition_variable m_ConditionVariable;
+  unsigned int            m_NumberOfLoadedChunks = 0;
+  unsigned int            m_NumberOfChunksInMemory = 0;
+  bool                    m_Aborted = false;
+  std::exception_ptr      m_Exception;
+};
+
+} // end namespace pct
+
+#endif
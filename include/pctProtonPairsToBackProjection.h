@@ -7,12 +7,16 @@
 #include <rtkQuadricShape.h>
 #include <rtkThreeDCircularProjectionGeometry.h>
 #include <itkInPlaceImageFilter.h>
+#include <algorithm>
+#include <future>
 #include <mutex>
 
 namespace pct
 {
 
-template <class TInputImage, class TOutputImage>
+template <class TInputImage,
+          class TOutputImage,
+          class TCountImage = itk::Image<unsigned int, TInputImage::ImageDimension>>
 class ITK_TEMPLATE_EXPORT ProtonPairsToBackProjection : public itk::InPlaceImageFilter<TInputImage, TOutputImage>
 {
 public:
@@ -28,8 +32,12 @@ public:
   using ProtonPairsImageType = itk::Image<ProtonPairsPixelType, 2>;
   using ProtonPairsImagePointer = ProtonPairsImageType::Pointer;
 
-  using CountImageType = typename itk::Image<unsigned int, TInputImage::ImageDimension>;
+  /** The counts saturate at the maximum of their pixel type, e.g., 65535
+   * protons per voxel with unsigned short counts to save memory. A saturated
+   * voxel does not accumulate more protons so that its average is preserved. */
+  using CountImageType = TCountImage;
   using CountImagePointer = typename CountImageType::Pointer;
+  using CountPixelType = typename CountImageType::PixelType;
 
   using OutputImageType = TOutputImage;
   using OutputImagePointer = typename OutputImageType::Pointer;
@@ -63,6 +71,11 @@ public:
     return m_ProtonPairsFileNames;
   }
 
+  /** Get/Set the number of pair files read in the background while the
+   * current one is backprojected. Default is 1. */
+  itkGetMacro(NumberOfPrefetchedFiles, unsigned int);
+  itkSetMacro(NumberOfPrefetchedFiles, unsigned int);
+
   /** Get/Set the most likely path type. Can be "schulte" or "polynomial" */
   itkGetMacro(MostLikelyPathType, std::string);
   itkSetMacro(MostLikelyPathType, std::string);
@@ -70,13 +83,22 @@ public:
   itkGetMacro(MostLikelyPathPolynomialDegree, int);
   itkSetMacro(MostLikelyPathPolynomialDegree, int);
 
+  /** Get/Set the sampling step in mm of the precomputed weights of the
+   * Schulte MLP, see SchulteMLPTable. Default is 0, the MLP is computed
+   * exactly for each proton. */
+  itkGetMacro(MostLikelyPathTableStep, double);
+  itkSetMacro(MostLikelyPathTableStep, double);
+
   /** Get/Set the boundaries of the object. */
   itkGetMacro(QuadricIn, RQIType::Pointer);
   itkSetMacro(QuadricIn, RQIType::Pointer);
   itkGetMacro(QuadricOut, RQIType::Pointer);
   itkSetMacro(QuadricOut, RQIType::Pointer);
 
-  /** Get/Set the count of proton pairs per pixel. */
+  /** Get/Set the count of proton pairs per pixel. If it is set with the
+   * region of the input, the input is the output of a previous run, i.e., the
+   * average of the protons counted in each pixel, and the accumulation is
+   * continued. */
   itkGetMacro(Counts, CountImagePointer);
   itkSetMacro(Counts, CountImagePointer);
 
@@ -110,6 +132,49 @@ protected:
   VerifyInputInformation() const override
   {}
 
+  /** Geometric tables of a projection shared by all threads. */
+  struct ProjectionTables
+  {
+    /** Rotation of the directions and rotation with mm to voxel conversion of the positions */
+    GeometryType::ThreeDHomogeneousMatrixType rotMat;
+    GeometryType::ThreeDHomogeneousMatrixType rotAndVoxConvMat;
+
+    /** rotAndVoxConvMat combined with the rotation canceling each angle bin, without rotation only */
+    std::vector<GeometryType::ThreeDHomogeneousMatrixType> noRotationMatrices;
+
+    /** Depths of the samples of the paths and voxel coordinates of (0, 0, -zmm[k]) */
+    std::vector<double>                 zmm;
+    std::vector<itk::Vector<double, 3>> zVoxel;
+  };
+
+  /** Compute the tables of projection iProj. */
+  void
+  ComputeProjectionTables(const unsigned int iProj, ProjectionTables & tables) const;
+
+  /** Compute the lookup table of GetAngleBin from the information of the input. */
+  void
+  ComputeAngleBinTable();
+
+  /** Angle bin of a direction from its slope x/z in the rotated coordinate
+   * system, -1 if it is outside the angle bins of the output. */
+  int
+  GetAngleBin(const double slope) const
+  {
+    return m_AngleBins[std::upper_bound(m_AngleBinSlopes.begin(), m_AngleBinSlopes.end(), slope) -
+                       m_AngleBinSlopes.begin()];
+  }
+
+  /** Update of a voxel of the output and count images. */
+  struct VoxelUpdate
+  {
+    typename OutputImageType::OffsetValueType offset;
+    double                                    value;
+  };
+
+  /** Apply the buffered updates of an angle bin to the output and count images and clear them. */
+  void
+  FlushVoxelUpdates(const unsigned int angle, std::vector<VoxelUpdate> & updates);
+
 private:
   ProtonPairsToBackProjection(const Self &); // purposely not implemented
   void
@@ -117,9 +182,11 @@ private:
 
   /** A list of filenames to be processed. */
   FileNamesContainer m_ProtonPairsFileNames;
+  unsigned int       m_NumberOfPrefetchedFiles = 1;
 
   std::string m_MostLikelyPathType;
   int         m_MostLikelyPathPolynomialDegree;
+  double      m_MostLikelyPathTableStep = 0.;
 
   /** Count event in each thread */
   CountImagePointer m_Counts;
@@ -142,7 +209,15 @@ private:
   /** Disable rotation to bin in coordinate orientation. Default is off. */
   bool m_DisableRotation = false;
 
-  std::mutex m_Mutex;
+  /** Lookup table of GetAngleBin, sorted slopes of the discontinuities and
+   * bin of the intervals between them */
+  std::vector<double> m_AngleBinSlopes;
+  std::vector<int>    m_AngleBins;
+
+  /** The output and count images are updated by angle bin, the last
+   * dimension, with buffered updates and one lock per angle bin. */
+  std::vector<std::mutex> m_AngleMutexes;
+  unsigned int            m_VoxelUpdatesPerAngle = 256;
 };
 
 } // end namespace pct
@@ -3,6 +3,10 @@
 
 #include <rtkHomogeneousMatrix.h>
 
+#include <algorithm>
+#include <deque>
+#include <utility>
+
 #include "pctThirdOrderPolynomialMLPFunction.h"
 #include "pctSchulteMLPFunction.h"
 #include "pctPolynomialMLPFunction.h"
@@ -11,13 +15,13 @@
 namespace pct
 {
 
-template <class TInputImage, class TOutputImage>
-ProtonPairsToBackProjection<TInputImage, TOutputImage>::ProtonPairsToBackProjection()
+template <class TInputImage, class TOutputImage, class TCountImage>
+ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::ProtonPairsToBackProjection()
 {}
 
-template <class TInputImage, class TOutputImage>
+template <class TInputImage, class TOutputImage, class TCountImage>
 void
-ProtonPairsToBackProjection<TInputImage, TOutputImage>::BeforeThreadedGenerateData()
+ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::BeforeThreadedGenerateData()
 {
   if (m_QuadricOut.GetPointer() == NULL)
     m_QuadricOut = m_QuadricIn;
@@ -25,8 +29,8 @@ ProtonPairsToBackProjection<TInputImage, TOutputImage>::BeforeThreadedGenerateDa
     m_IonizationPotential, 600. * CLHEP::MeV, 0.1 * CLHEP::keV);
 }
 
-template <class TInputImage, class TOutputImage>
-void ProtonPairsToBackProjection<TInputImage, TOutputImage>::GenerateData()
+template <class TInputImage, class TOutputImage, class TCountImage>
+void ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::GenerateData()
 {
   this->AllocateOutputs();
   this->BeforeThreadedGenerateData();
@@ -49,109 +53,114 @@ void ProtonPairsToBackProjection<TInputImage, TOutputImage>::GenerateData()
     itkGenericExceptionMacro("MLP must either be schulte, krah, or polynomial, not [" << m_MostLikelyPathType << ']');
   }
 
-  // Create thread image and corresponding stack to count events
-  m_Counts = CountImageType::New();
-  m_Counts->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-  m_Counts->Allocate();
-  m_Counts->FillBuffer(0);
-
-  for (unsigned int iProj = 0; iProj < m_ProtonPairsFileNames.size(); iProj++)
+  // Create thread image and corresponding stack to count events, or
+  // continue the accumulation of a previous run whose averages are converted
+  // back to sums
+  if (m_Counts.IsNull() || m_Counts->GetBufferedRegion() != this->GetInput()->GetLargestPossibleRegion())
   {
-    std::cout << std::endl << "Reading " << m_ProtonPairsFileNames[iProj] << "... " << std::flush;
-    // Read pairs
+    m_Counts = CountImageType::New();
+    m_Counts->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+    m_Counts->Allocate();
+    m_Counts->FillBuffer(0);
+  }
+  else
+  {
+    itk::ImageRegionIterator<TOutputImage>        itOut(this->GetOutput(), this->GetOutput()->GetRequestedRegion());
+    itk::ImageRegionConstIterator<CountImageType> itCount(m_Counts, this->GetOutput()->GetRequestedRegion());
+    for (; !itOut.IsAtEnd(); ++itOut, ++itCount)
+      itOut.Set(itOut.Get() * itCount.Get());
+  }
+  std::vector<std::mutex>(this->GetInput()->GetLargestPossibleRegion().GetSize(3)).swap(m_AngleMutexes);
+
+  this->ComputeAngleBinTable();
+
+  // Weights of the Schulte MLP shared by all threads, computed with the first file
+  SchulteMLPTable::Pointer schulteTable;
+
+  // Pair files are read in the background, up to m_NumberOfPrefetchedFiles
+  // files ahead of the one being backprojected
+  auto readPairs = [](const std::string fileName) {
     using ReaderType = itk::ImageFileReader<ProtonPairsImageType>;
     ReaderType::Pointer reader = ReaderType::New();
-    reader->SetFileName(m_ProtonPairsFileNames[iProj]);
+    reader->SetFileName(fileName);
     reader->Update();
-    m_ProtonPairs = reader->GetOutput();
+    ProtonPairsImagePointer pairs = reader->GetOutput();
+    pairs->DisconnectPipeline();
+    return pairs;
+  };
+  std::deque<std::future<ProtonPairsImagePointer>> prefetchedPairs;
+  unsigned int                                     nextFile = 0;
+
+  for (unsigned int iProj = 0; iProj < m_ProtonPairsFileNames.size(); iProj++)
+  {
+    for (; nextFile < m_ProtonPairsFileNames.size() && nextFile <= iProj + m_NumberOfPrefetchedFiles; nextFile++)
+      prefetchedPairs.push_back(std::async(std::launch::async, readPairs, m_ProtonPairsFileNames[nextFile]));
+
+    std::cout << std::endl << "Reading " << m_ProtonPairsFileNames[iProj] << "... " << std::flush;
+    m_ProtonPairs = prefetchedPairs.front().get();
+    prefetchedPairs.pop_front();
 
     std::cout << "Done !" << std::endl;
 
+    if (iProj == 0 && m_MostLikelyPathType == "schulte" && m_MostLikelyPathTableStep > 0.)
+    {
+      // Protons up to the distance between the trackers of the first pair
+      ProtonPairsImageType::IndexType idxPIn = m_ProtonPairs->GetLargestPossibleRegion().GetIndex();
+      ProtonPairsImageType::IndexType idxPOut = idxPIn;
+      idxPOut[0]++;
+      schulteTable = SchulteMLPTable::New();
+      schulteTable->Compute(m_ProtonPairs->GetPixel(idxPOut)[2] - m_ProtonPairs->GetPixel(idxPIn)[2],
+                            m_MostLikelyPathTableStep);
+    }
+
+    ProjectionTables tables;
+    this->ComputeProjectionTables(iProj, tables);
+
     this->GetMultiThreader()->template ParallelizeImageRegion<ProtonPairsImageType::ImageDimension>(
       m_ProtonPairs->GetLargestPossibleRegion(),
-      [this, iProj](const ProtonPairsImageType::RegionType & outputRegionForThread) {
+      [this, iProj, schulteTable, &tables](const ProtonPairsImageType::RegionType & outputRegionForThread) {
         // Create MLP depending on type
         pct::MostLikelyPathFunction<double>::Pointer mlp;
         if (m_MostLikelyPathType == "polynomial")
           mlp = pct::ThirdOrderPolynomialMLPFunction<double>::New();
         else if (m_MostLikelyPathType == "schulte")
-          mlp = pct::SchulteMLPFunction::New();
-        else
         {
-          itkGenericExceptionMacro("MLP must either be schulte or polynomial, not [" << m_MostLikelyPathType << ']');
+          pct::SchulteMLPFunction::Pointer mlp_schulte = pct::SchulteMLPFunction::New();
+          mlp_schulte->SetTable(schulteTable);
+          mlp = mlp_schulte;
         }
-
-        // Get geometry information. We need the rotation matrix alone to rotate the direction
-        // and the same matrix combined with mm (physical point) to voxel conversion for the volume.
-        GeometryType::ThreeDHomogeneousMatrixType rotMat, volPPToIndex;
-
-        rotMat = m_Geometry->GetRotationMatrices()[iProj].GetInverse();
-
-        itk::Matrix<double, 5, 5> volPPToIndex44;
-        volPPToIndex44 = rtk::GetPhysicalPointToIndexMatrix(this->GetInput());
-        for (int j = 0; j < 3; j++)
+        else
         {
-          for (int i = 0; i < 3; i++)
-            volPPToIndex[j][i] = volPPToIndex44[j][i];
-          volPPToIndex[j][3] = volPPToIndex44[j][4];
+          itkGenericExceptionMacro("MLP must either be schulte or polynomial, not [" << m_MostLikelyPathType << ']');
         }
-        volPPToIndex[3][3] = 1.;
-
-        GeometryType::ThreeDHomogeneousMatrixType rotAndVoxConvMat;
-        rotAndVoxConvMat = volPPToIndex.GetVnlMatrix() * rotMat.GetVnlMatrix();
 
         // Image information constants
         const typename OutputImageType::SizeType    imgSize = this->GetInput()->GetBufferedRegion().GetSize();
         const typename OutputImageType::SpacingType imgSpacing = this->GetInput()->GetSpacing();
-        const double                                halfSpacingRadian = imgSpacing[3] * itk::Math::pi / 360.;
 
-        typename OutputImageType::PixelType * imgData = this->GetOutput()->GetBufferPointer();
-        unsigned int *                        imgCountData = m_Counts->GetBufferPointer();
-        itk::Vector<float, 3>                 imgSpacingInv;
-        double                                minSpacing = imgSpacing[0];
-        for (unsigned int i = 0; i < 3; i++)
-        {
-          imgSpacingInv[i] = 1. / imgSpacing[i];
-          minSpacing = std::min(imgSpacing[i], minSpacing);
-        }
+        // Step of the samples along the paths
+        const double minSpacing = std::min(std::min(imgSpacing[0], imgSpacing[1]), imgSpacing[2]);
 
-        // Create matrices to cancel rotation
-        std::vector<GeometryType::ThreeDHomogeneousMatrixType> noRotationMatrices;
-        for (unsigned int i = 0; i < imgSize[3]; i++)
-        {
-          GeometryType::ThreeDHomogeneousMatrixType m;
-          m = m_Geometry->ComputeRotationHomogeneousMatrix(0, -1. * i * itk::Math::pi / imgSize[3], 0);
-          m = rotAndVoxConvMat.GetVnlMatrix() * m.GetVnlMatrix();
-          noRotationMatrices.push_back(m);
-        }
+        // Tables of the projection
+        const GeometryType::ThreeDHomogeneousMatrixType & rotMat = tables.rotMat;
+        const GeometryType::ThreeDHomogeneousMatrixType & rotAndVoxConvMat = tables.rotAndVoxConvMat;
+        const std::vector<double> &                       zmm = tables.zmm;
 
         // Corrections
         using VectorType = itk::Vector<double, 3>;
 
-        // Calculate corner positions and largest diagonal in axial plane
-        typename TOutputImage::IndexType idxCorner1, idxCorner2;
-        idxCorner1 = this->GetInput()->GetLargestPossibleRegion().GetIndex();
-        idxCorner2 = idxCorner1 + this->GetInput()->GetLargestPossibleRegion().GetSize();
-        for (unsigned int i = 0; i < TOutputImage::ImageDimension; i++)
-          idxCorner1[i] -= 1;
-        typename TOutputImage::PointType corner1, corner2;
-        this->GetInput()->TransformIndexToPhysicalPoint(idxCorner1, corner1);
-        this->GetInput()->TransformIndexToPhysicalPoint(idxCorner2, corner2);
-        const double cornerMaxX = std::max(std::fabs(corner1[0]), std::fabs(corner2[0]));
-        const double cornerMaxZ = std::max(std::fabs(corner1[2]), std::fabs(corner2[2]));
-        const double largestDiagonal = sqrt(cornerMaxX * cornerMaxX + cornerMaxZ * cornerMaxZ);
-
-        // Create zmm lut (look up table)
-        const double zPlaneInInMM = -1. * largestDiagonal;
-        const double zPlaneOutInMM = largestDiagonal;
-        if (zPlaneInInMM > zPlaneOutInMM)
-        {
-          itkGenericExceptionMacro("Required condition pIn[2] > pOut[2] is not met, check coordinate system.");
-        }
-        std::vector<double> zmm;
-        zmm.push_back(zPlaneInInMM);
-        while (zmm.back() + minSpacing < zPlaneOutInMM)
-          zmm.push_back(zmm.back() + minSpacing);
+        // Path buffers of the thread, allocated once for all protons
+        std::vector<double> xxArr(zmm.size());
+        std::vector<double> yyArr(zmm.size());
+
+        // Updates of the output and count images, buffered by angle bin
+        std::vector<std::vector<VoxelUpdate>> angleUpdates(imgSize[3]);
+        for (auto & updates : angleUpdates)
+          updates.reserve(m_VoxelUpdatesPerAngle);
+
+        // Voxels crossed by the path of the current proton with their angle bin
+        std::vector<std::pair<typename OutputImageType::OffsetValueType, unsigned int>> protonVoxels;
+        protonVoxels.reserve(zmm.size());
 
         // Process pairs
         itk::ImageRegionIterator<ProtonPairsImageType> it(m_ProtonPairs, outputRegionForThread);
@@ -209,82 +218,90 @@ void ProtonPairsToBackProjection<TInputImage, TOutputImage>::GenerateData()
           dOut[1] /= dOut[2];
           // dOut[2] = 1.; SR: implicit in the following
 
-          VectorType dCurr = dIn;
-          VectorType pCurr(0.);
-
           // Init MLP before mm to voxel conversion
           mlp->Init(pSIn, pSOut, dIn, dOut);
 
+          // Straight lines outside the object and MLP inside. The samples
+          // inside are contiguous and evaluated at once in the path buffers.
+          unsigned int kFirstMLP = zmm.size(), kLastMLP = 0;
           for (unsigned int k = 0; k < zmm.size(); k++)
           {
-            pCurr[2] = zmm[k];
-            if (pCurr[2] <= pSIn[2]) // before entrance
+            if (zmm[k] <= pSIn[2]) // before entrance
             {
-              const double z = (pCurr[2] - pIn[2]);
-              pCurr[0] = pIn[0] + z * dIn[0];
-              pCurr[1] = pIn[1] + z * dIn[1];
-              dCurr = dIn;
+              const double z = (zmm[k] - pIn[2]);
+              xxArr[k] = pIn[0] + z * dIn[0];
+              yyArr[k] = pIn[1] + z * dIn[1];
             }
-            else if (pCurr[2] >= pSOut[2]) // after exit
+            else if (zmm[k] >= pSOut[2]) // after exit
             {
-              const double z = (pCurr[2] - pSOut[2]);
-              pCurr[0] = pSOut[0] + z * dOut[0];
-              pCurr[1] = pSOut[1] + z * dOut[1];
-              dCurr = dOut;
+              const double z = (zmm[k] - pSOut[2]);
+              xxArr[k] = pSOut[0] + z * dOut[0];
+              yyArr[k] = pSOut[1] + z * dOut[1];
             }
-            else // MLP
+            else
+            {
+              kFirstMLP = std::min(kFirstMLP, k);
+              kLastMLP = k;
+            }
+          }
+          if (kFirstMLP <= kLastMLP)
+          {
+            const size_t nMLP = kLastMLP - kFirstMLP + 1;
+            mlp->Evaluate(zmm.data() + kFirstMLP, nMLP, xxArr.data() + kFirstMLP, yyArr.data() + kFirstMLP);
+          }
+
+          // Each voxel crossed by the path is accumulated once per proton, even
+          // if the rounded path leaves it and comes back. Consecutive samples in
+          // the same voxel are skipped, the other repeats are removed below.
+          typename OutputImageType::OffsetValueType lastOffset = -1;
+          protonVoxels.clear();
+          for (unsigned int k = 0; k < zmm.size(); k++)
+          {
+            VectorType pCurr, dCurr;
+            pCurr[0] = xxArr[k];
+            pCurr[1] = yyArr[k];
+            pCurr[2] = zmm[k];
+            if (zmm[k] <= pSIn[2]) // before entrance
+              dCurr = dIn;
+            else if (zmm[k] >= pSOut[2]) // after exit
+              dCurr = dOut;
+            else if (k == 0) // MLP without previous sample
+              dCurr = dIn;
+            else // MLP, direction from the previous sample
             {
-              double dx, dy;
-              dCurr[0] = pCurr[0];
-              dCurr[1] = pCurr[1];
+              dCurr[0] = xxArr[k] - xxArr[k - 1];
+              dCurr[1] = yyArr[k] - yyArr[k - 1];
               dCurr[2] = minSpacing;
-              mlp->Evaluate(zmm[k], pCurr[0], pCurr[1], dx, dy);
-              dCurr[0] = pCurr[0] - dCurr[0];
-              dCurr[1] = pCurr[1] - dCurr[1];
             }
             dCurr[2] *= -1.;
             pCurr[2] *= -1.;
 
-            // estimate direction
-            VectorType dCurrRot(0.);
-            for (unsigned int i = 0; i < 3; i++)
+            // Angle bin of the direction from its rotated slope, only x and z are rotated
+            double dCurrRotX = 0., dCurrRotZ = 0.;
+            for (unsigned int j = 0; j < 3; j++)
             {
-              for (unsigned int j = 0; j < 3; j++)
-              {
-                dCurrRot[i] += rotMat[i][j] * dCurr[j];
-              }
+              dCurrRotX += rotMat[0][j] * dCurr[j];
+              dCurrRotZ += rotMat[2][j] * dCurr[j];
             }
-            double theta = std::atan(dCurrRot[0] / dCurrRot[2]) + halfSpacingRadian;
-            theta /= itk::Math::pi;     // Convert to half turns
-            theta -= std::floor(theta); // Between 0 and 1 (i.e., 0 and pi)
-            theta *= 180.;              // To degrees
-            // To pixel index
-            theta -= this->GetOutput()->GetOrigin()[3];
-            theta /= this->GetOutput()->GetSpacing()[3];
             typename OutputImageType::IndexType idx;
-            idx[3] = itk::Math::Floor<int>(theta);
-            if (idx[3] < 0 || idx[3] >= (int)imgSize[3])
+            idx[3] = this->GetAngleBin(dCurrRotX / dCurrRotZ);
+            if (idx[3] < 0)
               continue;
 
-            // rotation + mm to voxel conversion
+            // rotation + mm to voxel conversion, the z column is precomputed
+            // for each sample with the rotation
             VectorType pCurrRot;
             if (m_DisableRotation)
             {
+              const GeometryType::ThreeDHomogeneousMatrixType & m = tables.noRotationMatrices[idx[3]];
               for (unsigned int i = 0; i < 3; i++)
-              {
-                pCurrRot[i] = noRotationMatrices[idx[3]][i][3];
-                for (unsigned int j = 0; j < 3; j++)
-                  pCurrRot[i] += noRotationMatrices[idx[3]][i][j] * pCurr[j];
-              }
+                pCurrRot[i] = m[i][3] + m[i][0] * pCurr[0] + m[i][1] * pCurr[1] + m[i][2] * pCurr[2];
             }
             else
             {
               for (unsigned int i = 0; i < 3; i++)
-              {
-                pCurrRot[i] = rotAndVoxConvMat[i][3];
-                for (unsigned int j = 0; j < 3; j++)
-                  pCurrRot[i] += rotAndVoxConvMat[i][j] * pCurr[j];
-              }
+                pCurrRot[i] =
+                  tables.zVoxel[k][i] + rotAndVoxConvMat[i][0] * pCurr[0] + rotAndVoxConvMat[i][1] * pCurr[1];
             }
 
             for (int i = 0; i < 3; i++)
@@ -293,13 +310,25 @@ void ProtonPairsToBackProjection<TInputImage, TOutputImage>::GenerateData()
                 idx[2] < (int)imgSize[2])
             {
               typename OutputImageType::OffsetValueType offset = this->GetOutput()->ComputeOffset(idx);
-              m_Mutex.lock();
-              imgData[offset] += value;
-              imgCountData[offset]++;
-              m_Mutex.unlock();
+              if (offset == lastOffset)
+                continue;
+              lastOffset = offset;
+              protonVoxels.emplace_back(offset, idx[3]);
             }
           }
+          std::sort(protonVoxels.begin(), protonVoxels.end());
+          protonVoxels.erase(std::unique(protonVoxels.begin(), protonVoxels.end()), protonVoxels.end());
+          for (const auto & voxel : protonVoxels)
+          {
+            angleUpdates[voxel.second].push_back({ voxel.first, value });
+            if (angleUpdates[voxel.second].size() == m_VoxelUpdatesPerAngle)
+              this->FlushVoxelUpdates(voxel.second, angleUpdates[voxel.second]);
+          }
         }
+
+        // Apply the remaining buffered updates
+        for (unsigned int angle = 0; angle < angleUpdates.size(); angle++)
+          this->FlushVoxelUpdates(angle, angleUpdates[angle]);
       },
       nullptr);
     std::cout << '\r' << "Pair file #" << iProj + 1 << " out of " << m_ProtonPairsFileNames.size() << ", "
@@ -312,8 +341,169 @@ void ProtonPairsToBackProjection<TInputImage, TOutputImage>::GenerateData()
   this->AfterThreadedGenerateData();
 }
 
-template <class TInputImage, class TOutputImage>
-void ProtonPairsToBackProjection<TInputImage, TOutputImage>::AfterThreadedGenerateData()
+template <class TInputImage, class TOutputImage, class TCountImage>
+void
+ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::ComputeProjectionTables(
+  const unsigned int iProj,
+  ProjectionTables & tables) const
+{
+  // Get geometry information. We need the rotation matrix alone to rotate the direction
+  // and the same matrix combined with mm (physical point) to voxel conversion for the volume.
+  GeometryType::ThreeDHomogeneousMatrixType volPPToIndex;
+
+  tables.rotMat = m_Geometry->GetRotationMatrices()[iProj].GetInverse();
+
+  itk::Matrix<double, 5, 5> volPPToIndex44;
+  volPPToIndex44 = rtk::GetPhysicalPointToIndexMatrix(this->GetInput());
+  for (int j = 0; j < 3; j++)
+  {
+    for (int i = 0; i < 3; i++)
+      volPPToIndex[j][i] = volPPToIndex44[j][i];
+    volPPToIndex[j][3] = volPPToIndex44[j][4];
+  }
+  volPPToIndex[3][3] = 1.;
+
+  tables.rotAndVoxConvMat = volPPToIndex.GetVnlMatrix() * tables.rotMat.GetVnlMatrix();
+
+  // Image information constants
+  const typename OutputImageType::SizeType    imgSize = this->GetInput()->GetBufferedRegion().GetSize();
+  const typename OutputImageType::SpacingType imgSpacing = this->GetInput()->GetSpacing();
+
+  // Step of the samples along the paths
+  const double minSpacing = std::min(std::min(imgSpacing[0], imgSpacing[1]), imgSpacing[2]);
+
+  // Create matrices to cancel rotation
+  tables.noRotationMatrices.clear();
+  if (m_DisableRotation)
+  {
+    for (unsigned int i = 0; i < imgSize[3]; i++)
+    {
+      GeometryType::ThreeDHomogeneousMatrixType m;
+      m = m_Geometry->ComputeRotationHomogeneousMatrix(0, -1. * i * itk::Math::pi / imgSize[3], 0);
+      m = tables.rotAndVoxConvMat.GetVnlMatrix() * m.GetVnlMatrix();
+      tables.noRotationMatrices.push_back(m);
+    }
+  }
+
+  // Calculate corner positions and largest diagonal in axial plane
+  typename TOutputImage::IndexType idxCorner1, idxCorner2;
+  idxCorner1 = this->GetInput()->GetLargestPossibleRegion().GetIndex();
+  idxCorner2 = idxCorner1 + this->GetInput()->GetLargestPossibleRegion().GetSize();
+  for (unsigned int i = 0; i < TOutputImage::ImageDimension; i++)
+    idxCorner1[i] -= 1;
+  typename TOutputImage::PointType corner1, corner2;
+  this->GetInput()->TransformIndexToPhysicalPoint(idxCorner1, corner1);
+  this->GetInput()->TransformIndexToPhysicalPoint(idxCorner2, corner2);
+  const double cornerMaxX = std::max(std::fabs(corner1[0]), std::fabs(corner2[0]));
+  const double cornerMaxZ = std::max(std::fabs(corner1[2]), std::fabs(corner2[2]));
+  const double largestDiagonal = sqrt(cornerMaxX * cornerMaxX + cornerMaxZ * cornerMaxZ);
+
+  // Create zmm lut (look up table), restricted to the extent of the
+  // volume along z in the coordinate system of the pairs. The volume
+  // moves with the angle bin without rotation, the largest diagonal
+  // bounds all of them.
+  double zPlaneInInMM = -1. * largestDiagonal;
+  double zPlaneOutInMM = largestDiagonal;
+  if (!m_DisableRotation)
+  {
+    zPlaneInInMM = itk::NumericTraits<double>::max();
+    zPlaneOutInMM = itk::NumericTraits<double>::NonpositiveMin();
+    for (unsigned int c = 0; c < 8; c++)
+    {
+      // z of the corner in the coordinate system of the pairs, which is flipped by the rotation
+      double z = 0.;
+      for (unsigned int i = 0; i < 3; i++)
+        z -= tables.rotMat[i][2] * (((c >> i) & 1) ? corner2[i] : corner1[i]);
+      zPlaneInInMM = std::min(zPlaneInInMM, z);
+      zPlaneOutInMM = std::max(zPlaneOutInMM, z);
+    }
+  }
+  if (zPlaneInInMM > zPlaneOutInMM)
+  {
+    itkGenericExceptionMacro("Required condition pIn[2] > pOut[2] is not met, check coordinate system.");
+  }
+  tables.zmm.clear();
+  tables.zmm.push_back(zPlaneInInMM);
+  while (tables.zmm.back() + minSpacing < zPlaneOutInMM)
+    tables.zmm.push_back(tables.zmm.back() + minSpacing);
+
+  // Voxel coordinates of (0, 0, -zmm[k]), the translation and the z column
+  // of the rotation and mm to voxel conversion for each sample
+  tables.zVoxel.resize(tables.zmm.size());
+  for (unsigned int k = 0; k < tables.zmm.size(); k++)
+  {
+    for (unsigned int i = 0; i < 3; i++)
+      tables.zVoxel[k][i] = tables.rotAndVoxConvMat[i][3] - tables.rotAndVoxConvMat[i][2] * tables.zmm[k];
+  }
+}
+
+template <class TInputImage, class TOutputImage, class TCountImage>
+void
+ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::ComputeAngleBinTable()
+{
+  // The angle bin of a direction is a piecewise constant function of its
+  // angle alpha = atan(x/z) in ]-90, 90[ degrees, shifted by half a bin and
+  // taken modulo 180 degrees. Its discontinuities are where the shifted
+  // angle wraps and at the boundaries of the bins.
+  const double       origin = this->GetInput()->GetOrigin()[3];
+  const double       spacing = this->GetInput()->GetSpacing()[3];
+  const unsigned int nbins = this->GetInput()->GetLargestPossibleRegion().GetSize(3);
+  const double       halfSpacing = 0.5 * spacing;
+
+  std::vector<double> alphas;
+  auto                addDiscontinuity = [&alphas](const double alpha) {
+    const double a = alpha - 180. * std::floor((alpha + 90.) / 180.); // Modulo 180 in [-90, 90[
+    if (a > -90.)
+      alphas.push_back(a);
+  };
+  addDiscontinuity(-halfSpacing);
+  for (unsigned int b = 0; b <= nbins; b++)
+    addDiscontinuity(origin + b * spacing - halfSpacing);
+  std::sort(alphas.begin(), alphas.end());
+  alphas.erase(std::unique(alphas.begin(), alphas.end()), alphas.end());
+
+  // Bin of each interval between consecutive discontinuities, the slopes of
+  // the discontinuities are sorted as the angles
+  m_AngleBinSlopes.resize(alphas.size());
+  m_AngleBins.resize(alphas.size() + 1);
+  for (unsigned int i = 0; i <= alphas.size(); i++)
+  {
+    const double first = (i == 0) ? -90. : alphas[i - 1];
+    const double last = (i == alphas.size()) ? 90. : alphas[i];
+    double       theta = (0.5 * (first + last) + halfSpacing) / 180.; // Convert to half turns
+    theta -= std::floor(theta);                                       // Between 0 and 1 (i.e., 0 and pi)
+    theta *= 180.;                                                    // To degrees
+    // To pixel index
+    const int bin = itk::Math::Floor<int>((theta - origin) / spacing);
+    m_AngleBins[i] = (bin < 0 || bin >= (int)nbins) ? -1 : bin;
+    if (i < alphas.size())
+      m_AngleBinSlopes[i] = std::tan(alphas[i] * itk::Math::pi / 180.);
+  }
+}
+
+template <class TInputImage, class TOutputImage, class TCountImage>
+void
+ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::FlushVoxelUpdates(
+  const unsigned int         angle,
+  std::vector<VoxelUpdate> & updates)
+{
+  typename OutputImageType::PixelType * imgData = this->GetOutput()->GetBufferPointer();
+  CountPixelType *                      imgCountData = m_Counts->GetBufferPointer();
+  const CountPixelType                  maxCount = itk::NumericTraits<CountPixelType>::max();
+
+  std::lock_guard<std::mutex> lock(m_AngleMutexes[angle]);
+  for (const VoxelUpdate & u : updates)
+  {
+    if (imgCountData[u.offset] == maxCount) // Saturated
+      continue;
+    imgData[u.offset] += u.value;
+    imgCountData[u.offset]++;
+  }
+  updates.clear();
+}
+
+template <class TInputImage, class TOutputImage, class TCountImage>
+void ProtonPairsToBackProjection<TInputImage, TOutputImage, TCountImage>::AfterThreadedGenerateData()
 {
   using ImageIteratorType = typename itk::ImageRegionIterator<TOutputImage>;
   ImageIteratorType itOut(this->GetOutput(), this->GetOutput()->GetRequestedRegion());
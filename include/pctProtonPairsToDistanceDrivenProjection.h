@@ -3,10 +3,18 @@
 
 #include "rtkConfiguration.h"
 #include "pctBetheBlochFunctor.h"
+#include "pctProtonPairsChunkReader.h"
+#include "pctThirdOrderPolynomialMLPFunction.h"
+#include "pctSchulteMLPFunction.h"
+#include "pctPolynomialMLPFunction.h"
+#include "pctEnergyAdaptiveMLPFunction.h"
 
 #include <rtkQuadricShape.h>
 #include <itkInPlaceImageFilter.h>
+#include <itkTimeProbe.h>
+#include <atomic>
 #include <mutex>
+#include <type_traits>
 
 namespace pct
 {
@@ -21,8 +29,9 @@ public:
   using Pointer = itk::SmartPointer<Self>;
   using ConstPointer = itk::SmartPointer<const Self>;
 
-  using ProtonPairsPixelType = itk::Vector<float, 3>;
-  using ProtonPairsImageType = itk::Image<ProtonPairsPixelType, 2>;
+  using ProtonPairsReaderType = ProtonPairsChunkReader;
+  using ProtonPairsPixelType = ProtonPairsReaderType::ProtonPairsPixelType;
+  using ProtonPairsImageType = ProtonPairsReaderType::ProtonPairsImageType;
   using ProtonPairsImagePointer = ProtonPairsImageType::Pointer;
 
   using CountImageType = itk::Image<unsigned int, 3>;
@@ -47,6 +56,25 @@ public:
   itkGetMacro(ProtonPairsFileName, std::string);
   itkSetMacro(ProtonPairsFileName, std::string);
 
+  /** Get/Set the number of proton pairs read at once. The pairs are streamed
+   * by chunks of this size and the next chunk is read while the current one is
+   * binned. 0 reads the whole file at once. Default is 1000000. */
+  itkGetMacro(NumberOfPairsPerChunk, itk::SizeValueType);
+  itkSetMacro(NumberOfPairsPerChunk, itk::SizeValueType);
+
+  /** Get/Set the number of proton pairs of the blocks handed out to the work
+   * units. The pairs of a chunk are scheduled dynamically by blocks, a work
+   * unit requests a new block when it has processed its previous one.
+   * Default is 4096. */
+  itkGetMacro(NumberOfPairsPerBlock, itk::SizeValueType);
+  itkSetMacro(NumberOfPairsPerBlock, itk::SizeValueType);
+
+  /** Get/Set the memory budget in MB for the accumulation images. If one copy
+   * per work unit does not fit in it, the work units share a single copy which
+   * is updated by slab of slices. Default is 4096. */
+  itkGetMacro(AccumulationMemoryBudget, double);
+  itkSetMacro(AccumulationMemoryBudget, double);
+
   /** Get/Set the source position. */
   itkGetMacro(SourceDistance, double);
   itkSetMacro(SourceDistance, double);
@@ -61,6 +89,12 @@ public:
   itkGetMacro(MostLikelyPathPolynomialDegree, int);
   itkSetMacro(MostLikelyPathPolynomialDegree, int);
 
+  /** Get/Set the sampling step in mm of the precomputed weights of the
+   * Schulte MLP, see SchulteMLPTable. Default is 0, the MLP is computed
+   * exactly for each proton. */
+  itkGetMacro(MostLikelyPathTableStep, double);
+  itkSetMacro(MostLikelyPathTableStep, double);
+
   itkGetMacro(TrackerResolution, double);
   itkSetMacro(TrackerResolution, double);
   itkGetMacro(TrackerPairSpacing, double);
@@ -109,6 +143,10 @@ public:
   itkGetConstMacro(ComputeNoise, bool);
   itkBooleanMacro(ComputeNoise);
 
+  /** Print the duration of the processing of the pairs and the utilization of each work unit. */
+  void
+  PrintTiming(std::ostream & os) const;
+
 protected:
   ProtonPairsToDistanceDrivenProjection();
   virtual ~ProtonPairsToDistanceDrivenProjection() {}
@@ -120,6 +158,123 @@ protected:
   virtual void
   AfterThreadedGenerateData() override;
 
+  /** Process the pairs of work unit threadId with the MLP mlp. evaluatePath(u, n, x, y)
+   * evaluates the path of the current proton at the n depths u inside the object.
+   * If TPathEvaluator has a NumberOfLanes constant, the protons are processed by
+   * batches of NumberOfLanes with its InitBatch and EvaluateBatch methods. */
+  template <class TMostLikelyPath, class TPathEvaluator>
+  void
+  ProcessProtonPairs(const rtk::ThreadIdType threadId, TMostLikelyPath * mlp, TPathEvaluator evaluatePath);
+
+  /** Path evaluation of PolynomialMLPFunction with its degree known at compile time. */
+  template <int VPolynomialDegree>
+  struct PolynomialPathEvaluator
+  {
+    static constexpr unsigned int NumberOfLanes = 8;
+
+    PolynomialMLPFunction *                                 mlp;
+    PolynomialMLPFunction::BatchCoefficients<NumberOfLanes> coefficients;
+
+    void
+    operator()(const double * u, const size_t n, double * x, double * y) const
+    {
+      mlp->EvaluateWithDegree<VPolynomialDegree>(u, n, x, y);
+    }
+    void
+    InitBatch(const double pIn[3][NumberOfLanes],
+              const double pOut[3][NumberOfLanes],
+              const double dIn[2][NumberOfLanes],
+              const double dOut[2][NumberOfLanes])
+    {
+      mlp->InitBatch<NumberOfLanes>(pIn, pOut, dIn, dOut, coefficients);
+    }
+    void
+    EvaluateBatch(const double u, double * x, double * y) const
+    {
+      PolynomialMLPFunction::EvaluateBatch<VPolynomialDegree, NumberOfLanes>(coefficients, u, x, y);
+    }
+  };
+
+  /** Number of protons processed in lock-step by ProcessProtonPairs, 1 if
+   * TPathEvaluator has no batch version. */
+  template <class TPathEvaluator, class = void>
+  struct PathEvaluatorLanes : std::integral_constant<unsigned int, 1>
+  {};
+  template <class TPathEvaluator>
+  struct PathEvaluatorLanes<TPathEvaluator, std::void_t<decltype(TPathEvaluator::NumberOfLanes)>>
+    : std::integral_constant<unsigned int, TPathEvaluator::NumberOfLanes>
+  {};
+
+  /** Protons gathered by ProcessProtonPairs in structure-of-arrays layout
+   * with their directions normalized to z. */
+  template <unsigned int VLanes>
+  struct ProtonBatch
+  {
+    double       pIn[3][VLanes];
+    double       pOut[3][VLanes];
+    double       dIn[2][VLanes];
+    double       dOut[2][VLanes];
+    double       value[VLanes];
+    double       anglex[VLanes];
+    double       angley[VLanes];
+    unsigned int size = 0;
+  };
+
+  /** Init an MLP without virtual call, only the energy adaptive MLP uses the energies. */
+  template <class TMostLikelyPath>
+  static void
+  InitMostLikelyPath(TMostLikelyPath *                            mlp,
+                     const typename TMostLikelyPath::VectorType & pIn,
+                     const typename TMostLikelyPath::VectorType & pOut,
+                     const typename TMostLikelyPath::VectorType & dIn,
+                     const typename TMostLikelyPath::VectorType & dOut,
+                     double                                       itkNotUsed(eIn),
+                     double                                       itkNotUsed(eOut))
+  {
+    mlp->TMostLikelyPath::Init(pIn, pOut, dIn, dOut);
+  }
+  static void
+  InitMostLikelyPath(EnergyAdaptiveMLPFunction *                 mlp,
+                     const EnergyAdaptiveMLPFunction::VectorType & pIn,
+                     const EnergyAdaptiveMLPFunction::VectorType & pOut,
+                     const EnergyAdaptiveMLPFunction::VectorType & dIn,
+                     const EnergyAdaptiveMLPFunction::VectorType & dOut,
+                     double                                        eIn,
+                     double                                        eOut)
+  {
+    mlp->EnergyAdaptiveMLPFunction::Init(pIn, pOut, dIn, dOut, eIn, eOut);
+  }
+
+  /** Allocate the accumulation images of work unit i. The images of work unit
+   * 0 are the outputs of the filter. */
+  void
+  AllocateAccumulationImages(const unsigned int i);
+
+  /** Update of a voxel of the shared accumulation images. */
+  struct VoxelUpdate
+  {
+    unsigned long idx;
+    double        value;
+    double        anglex;
+    double        angley;
+  };
+
+  /** Apply the buffered updates of a slab to the shared accumulation images and clear them. */
+  void
+  FlushVoxelUpdates(const unsigned int slab, std::vector<VoxelUpdate> & updates);
+
+  /** Scattering angles of a proton in a voxel of a slab, for robust estimation. */
+  struct RobustAngle
+  {
+    unsigned int voxel;
+    float        anglex;
+    float        angley;
+  };
+
+  /** Compute the robust scattering (38.30% quantile of the angles) in parallel over the slabs. */
+  void
+  ComputeRobustScattering();
+
   /** The two inputs should not be in the same space so there is nothing
    * to verify. */
   virtual void
@@ -131,10 +286,15 @@ private:
   void
   operator=(const Self &); // purposely not implemented
 
-  std::string m_ProtonPairsFileName;
-  double      m_SourceDistance;
-  std::string m_MostLikelyPathType;
-  int         m_MostLikelyPathPolynomialDegree;
+  std::string        m_ProtonPairsFileName;
+  itk::SizeValueType m_NumberOfPairsPerChunk = 1000000;
+  double             m_SourceDistance;
+  std::string        m_MostLikelyPathType;
+  int                m_MostLikelyPathPolynomialDegree;
+  double             m_MostLikelyPathTableStep = 0.;
+
+  /** Precomputed weights of the Schulte MLP shared by all threads */
+  SchulteMLPTable::Pointer m_SchulteMLPTable;
 
   double m_BeamEnergy;
   bool   m_VariableBeamEnergy = false;
@@ -149,10 +309,12 @@ private:
   CountImagePointer              m_Count;
   std::vector<CountImagePointer> m_Counts;
 
-  AngleImagePointer               m_Angle;
-  std::vector<AngleImagePointer>  m_Angles;
-  std::vector<std::vector<float>> m_AnglesVectors;
-  std::mutex                      m_AnglesVectorsMutex;
+  AngleImagePointer              m_Angle;
+  std::vector<AngleImagePointer> m_Angles;
+
+  /** Robust scattering angles of each work unit bucketed by slab, without
+   * synchronization between work units */
+  std::vector<std::vector<std::vector<RobustAngle>>> m_RobustAngles;
 
   AngleImagePointer              m_AngleSq;
   std::vector<AngleImagePointer> m_AnglesSq;
@@ -177,10 +339,31 @@ private:
   /** The functor to convert energy loss to attenuation */
   Functor::IntegratedBetheBlochProtonStoppingPowerInverse<float, double> * m_ConvFunc;
 
-  ProtonPairsImageType::Pointer m_ProtonPairs;
-  bool                          m_Robust;
-  bool                          m_ComputeScattering;
-  bool                          m_ComputeNoise;
+  /** Streaming reader of the pairs shared by all threads */
+  ProtonPairsReaderType::Pointer m_ProtonPairsReader;
+  unsigned int                   m_NumberOfActiveWorkUnits;
+  double                         m_ZPlaneOutInMM;
+
+  /** Dynamic scheduling, index of the next pair to process in each chunk */
+  itk::SizeValueType                           m_NumberOfPairsPerBlock = 4096;
+  std::vector<std::atomic<itk::SizeValueType>> m_NextPairInChunk;
+
+  /** Load balance statistics, see PrintTiming */
+  itk::TimeProbe                  m_ThreadedProbe;
+  std::vector<double>             m_WorkUnitBusyTimes;
+  std::vector<itk::SizeValueType> m_WorkUnitNumberOfPairs;
+
+  /** Shared accumulation images when per-thread copies exceed the memory budget */
+  double                  m_AccumulationMemoryBudget = 4096.;
+  bool                    m_SharedAccumulation = false;
+  unsigned int            m_SlicesPerSlab = 1;
+  unsigned int            m_NumberOfSlabs = 1;
+  unsigned int            m_VoxelUpdatesPerSlab = 256;
+  std::vector<std::mutex> m_SlabMutexes;
+
+  bool m_Robust;
+  bool m_ComputeScattering;
+  bool m_ComputeNoise;
 };
 
 } // end namespace pct
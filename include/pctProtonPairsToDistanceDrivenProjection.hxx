@@ -1,12 +1,12 @@
 #include <itkImageFileReader.h>
 #include <itkImageRegionIterator.h>
+#include <itkImageScanlineIterator.h>
 
-#include "pctThirdOrderPolynomialMLPFunction.h"
-#include "pctSchulteMLPFunction.h"
-#include "pctPolynomialMLPFunction.h"
-#include "pctEnergyAdaptiveMLPFunction.h"
 #include "pctEnergyStragglingFunctor.h"
 
+#include <limits>
+#include <type_traits>
+
 namespace pct
 {
 
@@ -29,7 +29,6 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::BeforeThreaded
   if (m_ComputeScattering)
   {
     m_Angles.resize(this->GetNumberOfWorkUnits());
-    m_AnglesVectors.resize(this->GetInput()->GetLargestPossibleRegion().GetNumberOfPixels());
     m_AnglesSq.resize(this->GetNumberOfWorkUnits());
   }
 
@@ -43,12 +42,84 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::BeforeThreaded
   m_ConvFunc = new Functor::IntegratedBetheBlochProtonStoppingPowerInverse<float, double>(
     m_IonizationPotential, 600. * CLHEP::MeV, 0.1 * CLHEP::keV);
 
-  // Read pairs
-  using ReaderType = itk::ImageFileReader<ProtonPairsImageType>;
-  ReaderType::Pointer reader = ReaderType::New();
-  reader->SetFileName(m_ProtonPairsFileName);
-  reader->Update();
-  m_ProtonPairs = reader->GetOutput();
+  // Number of work units which will actually call ThreadedGenerateData, each
+  // of them requests blocks of pairs until all chunks have been handed out
+  this->GetMultiThreader()->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+  OutputImageRegionType dummyRegion;
+  m_NumberOfActiveWorkUnits =
+    this->SplitRequestedRegion(0, this->GetMultiThreader()->GetNumberOfWorkUnits(), dummyRegion);
+
+  // One copy of the accumulation images per work unit if they fit in the
+  // memory budget, otherwise a single copy shared by all work units which is
+  // updated by slab of slices with buffered updates
+  size_t bytesPerVoxel = sizeof(typename OutputImageType::PixelType) + sizeof(unsigned int);
+  if (m_ComputeScattering && !m_Robust)
+    bytesPerVoxel += 2 * sizeof(float);
+  if (m_ComputeNoise)
+    bytesPerVoxel += sizeof(typename OutputImageType::PixelType);
+  const double perThreadMemory = double(this->GetInput()->GetLargestPossibleRegion().GetNumberOfPixels()) *
+                                 bytesPerVoxel * m_NumberOfActiveWorkUnits;
+  m_SharedAccumulation =
+    (m_NumberOfActiveWorkUnits > 1 && perThreadMemory > m_AccumulationMemoryBudget * 1024. * 1024.);
+
+  // Slabs of slices, the unit of locking of the shared accumulation images
+  // and of bucketing of the robust scattering angles
+  const unsigned int nslices = this->GetInput()->GetLargestPossibleRegion().GetSize(2);
+  const unsigned int nslabs = std::max(1u, std::min(nslices, 4 * m_NumberOfActiveWorkUnits));
+  m_SlicesPerSlab = std::max(1u, (nslices + nslabs - 1) / nslabs);
+  m_NumberOfSlabs = (nslices + m_SlicesPerSlab - 1) / m_SlicesPerSlab;
+  if (m_SharedAccumulation)
+  {
+    std::vector<std::mutex>(m_NumberOfSlabs).swap(m_SlabMutexes);
+    this->AllocateAccumulationImages(0);
+  }
+
+  // Robust scattering angles of each work unit, bucketed by slab
+  if (m_ComputeScattering && m_Robust)
+  {
+    const itk::SizeValueType npixelsPerSlab = itk::SizeValueType(m_SlicesPerSlab) *
+                                              this->GetInput()->GetLargestPossibleRegion().GetSize(0) *
+                                              this->GetInput()->GetLargestPossibleRegion().GetSize(1);
+    if (npixelsPerSlab > std::numeric_limits<decltype(RobustAngle::voxel)>::max())
+      itkExceptionMacro(<< "Too many pixels per slab (" << npixelsPerSlab << ") for robust scattering.");
+    m_RobustAngles.clear();
+    m_RobustAngles.resize(this->GetNumberOfWorkUnits(), std::vector<std::vector<RobustAngle>>(m_NumberOfSlabs));
+  }
+
+  // Start streaming pairs, the next chunk is read while the current one is processed
+  m_ProtonPairsReader = ProtonPairsReaderType::New();
+  m_ProtonPairsReader->SetFileName(m_ProtonPairsFileName);
+  m_ProtonPairsReader->SetNumberOfPairsPerChunk(m_NumberOfPairsPerChunk);
+  m_ProtonPairsReader->Start();
+  if (m_ProtonPairsReader->GetNumberOfChunks() == 0)
+  {
+    m_ProtonPairsReader->Stop();
+    itkExceptionMacro(<< "No proton pairs in " << m_ProtonPairsFileName);
+  }
+
+  // Exit plane, read from the first pair
+  ProtonPairsImageType::IndexType idxPIn = m_ProtonPairsReader->GetChunkRegion(0).GetIndex();
+  ProtonPairsImageType::IndexType idxPOut = idxPIn;
+  idxPOut[0]++;
+  m_ZPlaneOutInMM = m_ProtonPairsReader->GetChunk(0)->GetPixel(idxPOut)[2];
+
+  // Weights of the Schulte MLP for protons up to the distance between the trackers
+  m_SchulteMLPTable = nullptr;
+  if (m_MostLikelyPathType == "schulte" && m_MostLikelyPathTableStep > 0. && !m_MostLikelyPathTrackerUncertainties)
+  {
+    m_SchulteMLPTable = SchulteMLPTable::New();
+    m_SchulteMLPTable->Compute(m_ZPlaneOutInMM - m_ProtonPairsReader->GetChunk(0)->GetPixel(idxPIn)[2],
+                               m_MostLikelyPathTableStep);
+  }
+
+  // Dynamic scheduling of the pairs of each chunk and load balance statistics
+  std::vector<std::atomic<itk::SizeValueType>>(m_ProtonPairsReader->GetNumberOfChunks()).swap(m_NextPairInChunk);
+  for (auto & next : m_NextPairInChunk)
+    next = 0;
+  m_WorkUnitBusyTimes.assign(m_NumberOfActiveWorkUnits, 0.);
+  m_WorkUnitNumberOfPairs.assign(m_NumberOfActiveWorkUnits, 0);
+  m_ThreadedProbe.Reset();
+  m_ThreadedProbe.Start();
 }
 
 template <class TInputImage, class TOutputImage>
@@ -57,91 +128,95 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ThreadedGenera
   const OutputImageRegionType & itkNotUsed(outputRegionForThread),
   rtk::ThreadIdType             threadId)
 {
-  // Create MLP depending on type
-  pct::MostLikelyPathFunction<double>::Pointer mlp;
+  if (m_MostLikelyPathTrackerUncertainties && m_MostLikelyPathType != "schulte")
+  {
+    itkGenericExceptionMacro("Tracker uncertainties can currently only be considered with MLP type 'Schulte'.");
+  }
+
+  // The type of MLP is resolved once and the pairs are processed with a
+  // kernel specialized for it, where the evaluation of the path is inlined
   if (m_MostLikelyPathType == "polynomial")
-    mlp = pct::ThirdOrderPolynomialMLPFunction<double>::New();
+  {
+    using MLPType = ThirdOrderPolynomialMLPFunction<double>;
+    MLPType::Pointer mlp = MLPType::New();
+    this->ProcessProtonPairs(
+      threadId, mlp.GetPointer(), [&mlp](const double * u, const size_t n, double * x, double * y) {
+        mlp->MLPType::Evaluate(u, n, x, y);
+      });
+  }
   else if (m_MostLikelyPathType == "krah")
   {
-    pct::PolynomialMLPFunction::Pointer mlp_poly;
-    mlp_poly = pct::PolynomialMLPFunction::New();
-    mlp_poly->SetPolynomialDegree(m_MostLikelyPathPolynomialDegree);
-    mlp = mlp_poly;
+    PolynomialMLPFunction::Pointer mlp = PolynomialMLPFunction::New();
+    mlp->SetPolynomialDegree(m_MostLikelyPathPolynomialDegree);
+    switch (m_MostLikelyPathPolynomialDegree)
+    {
+      case 0:
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<0>{ mlp.GetPointer() });
+        break;
+      case 1:
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<1>{ mlp.GetPointer() });
+        break;
+      case 2:
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<2>{ mlp.GetPointer() });
+        break;
+      case 3:
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<3>{ mlp.GetPointer() });
+        break;
+      case 4:
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<4>{ mlp.GetPointer() });
+        break;
+      default: // Unsupported degrees fall back to degree 5, see PolynomialMLPFunction::SetPolynomialDegree
+        this->ProcessProtonPairs(threadId, mlp.GetPointer(), PolynomialPathEvaluator<5>{ mlp.GetPointer() });
+        break;
+    }
   }
   else if (m_MostLikelyPathType == "adaptive")
   {
-    mlp = pct::EnergyAdaptiveMLPFunction::New();
+    EnergyAdaptiveMLPFunction::Pointer mlp = EnergyAdaptiveMLPFunction::New();
+    this->ProcessProtonPairs(
+      threadId, mlp.GetPointer(), [&mlp](const double * u, const size_t n, double * x, double * y) {
+        mlp->EnergyAdaptiveMLPFunction::Evaluate(u, n, x, y);
+      });
   }
   else if (m_MostLikelyPathType == "schulte")
   {
-    mlp = pct::SchulteMLPFunction::New();
+    SchulteMLPFunction::Pointer mlp = SchulteMLPFunction::New();
+    mlp->SetTable(m_SchulteMLPTable);
+    this->ProcessProtonPairs(
+      threadId, mlp.GetPointer(), [&mlp](const double * u, const size_t n, double * x, double * y) {
+        mlp->SchulteMLPFunction::Evaluate(u, n, x, y);
+      });
   }
   else
   {
     itkGenericExceptionMacro("MLP must either be schulte, polynomial, krah, or adaptive, not [" << m_MostLikelyPathType
                                                                                                 << ']');
   }
-  if (m_MostLikelyPathTrackerUncertainties && m_MostLikelyPathType != "schulte")
-  {
-    itkGenericExceptionMacro("Tracker uncertainties can currently only be considered with MLP type 'Schulte'.");
-  }
-
-  // Create thread image and corresponding stack to count events
-  m_Counts[threadId] = CountImageType::New();
-  m_Counts[threadId]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-  m_Counts[threadId]->Allocate();
-  m_Counts[threadId]->FillBuffer(0);
-
-  if (m_ComputeScattering &&
-      (!m_Robust || threadId == 0)) // Note NK: is this condition correct? Should it not be !(m_Robust || threadId==0) ?
-  {
-    m_Angles[threadId] = AngleImageType::New();
-    m_Angles[threadId]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-    m_Angles[threadId]->Allocate();
-    m_Angles[threadId]->FillBuffer(0);
-
-    m_AnglesSq[threadId] = AngleImageType::New();
-    m_AnglesSq[threadId]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-    m_AnglesSq[threadId]->Allocate();
-    m_AnglesSq[threadId]->FillBuffer(0);
-  }
+}
 
-  if (m_ComputeNoise)
+template <class TInputImage, class TOutputImage>
+template <class TMostLikelyPath, class TPathEvaluator>
+void
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ProcessProtonPairs(
+  const rtk::ThreadIdType threadId,
+  TMostLikelyPath *       mlp,
+  TPathEvaluator          evaluatePath)
+{
+  // Accumulation images of the thread, or of all threads if they share them
+  if (!m_SharedAccumulation)
+    this->AllocateAccumulationImages(threadId);
+  const unsigned int bufferId = (m_SharedAccumulation) ? 0 : threadId;
+
+  // Updates of the shared accumulation images, buffered by slab of slices
+  std::vector<std::vector<VoxelUpdate>> slabUpdates;
+  if (m_SharedAccumulation)
   {
-    m_SquaredOutputs[threadId] = OutputImageType::New();
-    m_SquaredOutputs[threadId]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-    m_SquaredOutputs[threadId]->Allocate();
-    m_SquaredOutputs[threadId]->FillBuffer(0);
+    slabUpdates.resize(m_NumberOfSlabs);
+    for (auto & updates : slabUpdates)
+      updates.reserve(m_VoxelUpdatesPerSlab);
   }
 
-  if (threadId == 0)
-  {
-    m_Outputs[0] = this->GetOutput();
-    m_Count = m_Counts[0];
-    if (m_ComputeScattering)
-    {
-      m_Angle = m_Angles[0];
-      m_AngleSq = m_AnglesSq[0];
-    }
-    if (m_ComputeNoise)
-      m_SquaredOutput = m_SquaredOutputs[0];
-  }
-  else
-  {
-    m_Outputs[threadId] = OutputImageType::New();
-    m_Outputs[threadId]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
-    m_Outputs[threadId]->Allocate();
-  }
-  m_Outputs[threadId]->FillBuffer(0.);
-
-  size_t                           nprotons = m_ProtonPairs->GetLargestPossibleRegion().GetSize()[1];
-  size_t                           nprotonsPerThread = nprotons / this->GetMultiThreader()->GetNumberOfWorkUnits();
-  ProtonPairsImageType::RegionType region = m_ProtonPairs->GetLargestPossibleRegion();
-  region.SetIndex(1, threadId * nprotonsPerThread);
-  if (threadId == this->GetMultiThreader()->GetNumberOfWorkUnits() - 1)
-    region.SetSize(1, nprotons - region.GetIndex(1));
-  else
-    region.SetSize(1, nprotons / this->GetMultiThreader()->GetNumberOfWorkUnits());
+  const size_t nprotons = m_ProtonPairsReader->GetLargestPossibleRegion().GetSize(1);
 
   // Image information constants
   const typename OutputImageType::SizeType    imgSize = this->GetInput()->GetBufferedRegion().GetSize();
@@ -149,18 +224,18 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ThreadedGenera
   const typename OutputImageType::SpacingType imgSpacing = this->GetInput()->GetSpacing();
   const unsigned long                         npixelsPerSlice = imgSize[0] * imgSize[1];
 
-  typename OutputImageType::PixelType * imgData = m_Outputs[threadId]->GetBufferPointer();
+  typename OutputImageType::PixelType * imgData = m_Outputs[bufferId]->GetBufferPointer();
   typename OutputImageType::PixelType * imgSquaredData = NULL;
-  unsigned int *                        imgCountData = m_Counts[threadId]->GetBufferPointer();
+  unsigned int *                        imgCountData = m_Counts[bufferId]->GetBufferPointer();
   float *                               imgAngleData = NULL, *imgAngleSqData = NULL;
   if (m_ComputeScattering && !m_Robust)
   {
-    imgAngleData = m_Angles[threadId]->GetBufferPointer();
-    imgAngleSqData = m_AnglesSq[threadId]->GetBufferPointer();
+    imgAngleData = m_Angles[bufferId]->GetBufferPointer();
+    imgAngleSqData = m_AnglesSq[bufferId]->GetBufferPointer();
   }
   if (m_ComputeNoise)
   {
-    imgSquaredData = m_SquaredOutputs[threadId]->GetBufferPointer();
+    imgSquaredData = m_SquaredOutputs[bufferId]->GetBufferPointer();
   }
 
   itk::Vector<float, 3> imgSpacingInv;
@@ -171,293 +246,397 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ThreadedGenera
   using VectorType = itk::Vector<double, 3>;
 
   // Create zmm and magnitude lut (look up table)
-  itk::ImageRegionIterator<ProtonPairsImageType> it(m_ProtonPairs, region);
-  std::vector<double>                            zmm(imgSize[2]);
-  std::vector<double>                            zmag(imgSize[2]);
-  ++it;
-  const double zPlaneOutInMM = it.Get()[2];
-  --it;
+  std::vector<double> zmm(imgSize[2]);
+  std::vector<double> zmag(imgSize[2]);
   for (unsigned int i = 0; i < imgSize[2]; i++)
   {
     zmm[i] = i * imgSpacing[2] + imgOrigin[2];
-    zmag[i] = (m_SourceDistance == 0.) ? 1 : (zPlaneOutInMM - m_SourceDistance) / (zmm[i] - m_SourceDistance);
+    zmag[i] = (m_SourceDistance == 0.) ? 1 : (m_ZPlaneOutInMM - m_SourceDistance) / (zmm[i] - m_SourceDistance);
   }
 
-  // Process pairs
-  while (!it.IsAtEnd())
-  {
-    if (threadId == 0 && it.GetIndex()[1] % 10000 == 0)
+  // Path buffers of the thread, allocated once for all protons
+  std::vector<double> xxArr(imgSize[2]);
+  std::vector<double> yyArr(imgSize[2]);
+
+  // Accumulation of a proton in voxel idx of slice k
+  auto accumulate = [&](const unsigned int  k,
+                        const unsigned long idx,
+                        const double        value,
+                        const double        anglex,
+                        const double        angley) {
+    const unsigned int slab = k / m_SlicesPerSlab;
+    if (m_ComputeScattering && m_Robust)
     {
-      std::cout << '\r' << it.GetIndex()[1] << " pairs of protons processed ("
-                << 100 * it.GetIndex()[1] / region.GetSize(1) << "%) in thread 1" << std::flush;
+      const unsigned int voxelInSlab = idx - slab * m_SlicesPerSlab * npixelsPerSlice;
+      m_RobustAngles[threadId][slab].push_back({ voxelInSlab, float(anglex), float(angley) });
     }
-
-    VectorType pIn = it.Get();
-    ++it;
-    VectorType pOut = it.Get();
-    ++it;
-    VectorType dIn = it.Get();
-    ++it;
-    VectorType dOut = it.Get();
-    ++it;
-
-    double anglex = 0., angley = 0.;
-    if (m_ComputeScattering)
+    if (m_SharedAccumulation)
     {
-      using VectorTwoDType = itk::Vector<double, 2>;
-
-      VectorTwoDType dInX, dInY, dOutX, dOutY;
-      dInX[0] = dIn[0];
-      dInX[1] = dIn[2];
-      dInY[0] = dIn[1];
-      dInY[1] = dIn[2];
-      dOutX[0] = dOut[0];
-      dOutX[1] = dOut[2];
-      dOutY[0] = dOut[1];
-      dOutY[1] = dOut[2];
-
-      angley = std::acos(std::min(1., dInY * dOutY / (dInY.GetNorm() * dOutY.GetNorm())));
-      anglex = std::acos(std::min(1., dInX * dOutX / (dInX.GetNorm() * dOutX.GetNorm())));
+      slabUpdates[slab].push_back({ idx, value, anglex, angley });
+      if (slabUpdates[slab].size() == m_VoxelUpdatesPerSlab)
+        this->FlushVoxelUpdates(slab, slabUpdates[slab]);
     }
-
-    if (pIn[2] > pOut[2])
-    {
-      // NK: maybe this check should consider the incoming direction of the protons
-      // because pIn > pOut if the beam goes e.g. along -x. That should not cause an exception.
-      itkGenericExceptionMacro("Required condition pIn[2] < pOut[2] is not met, check coordinate system.");
-    }
-    if (dIn[2] < 0.)
-    {
-      itkGenericExceptionMacro("The code assumes that protons move in positive z.");
-    }
-
-    const double eIn = it.Get()[0];
-    const double eOut = it.Get()[1];
-    double       value = 0.;
-    if (eIn == 0.)
+    else
     {
-      if (m_MostLikelyPathType == "flexible")
+      imgData[idx] += value;
+      if (m_ComputeNoise)
       {
-        itkGenericExceptionMacro(
-          "The FlexibleMLP is not supported if WEPL values are directed provided instead of energy.");
+        imgSquaredData[idx] += value * value;
       }
-      value = eOut; // Directly read WEPL
-    }
-    else
-    {
-      value = m_ConvFunc->GetValue(eOut, eIn); // convert to WEPL
-    }
-    ++it;
-
-    VectorType nucInfo(0.);
-    if (it.GetIndex()[0] != 0)
-    {
-      nucInfo = it.Get();
-      ++it;
-    }
-
-    // Move straight to entrance and exit shapes
-
-
-    VectorType pSIn = pIn;
-    VectorType pSOut = pOut;
-    double     nearDistIn, nearDistOut, farDistIn, farDistOut;
-    double     distanceEntry, distanceExit;
-    bool       QuadricIntersected = false;
-    if (m_QuadricIn.GetPointer() != NULL)
-    {
-      if (m_QuadricIn->IsIntersectedByRay(pIn, dIn, nearDistIn, farDistIn) &&
-          m_QuadricOut->IsIntersectedByRay(pOut, dOut, farDistOut, nearDistOut))
+      imgCountData[idx]++;
+      if (m_ComputeScattering && !m_Robust)
       {
-        QuadricIntersected = true;
-        pSIn = pIn + dIn * nearDistIn;
-        distanceEntry = nearDistIn;
-        if (pSIn[2] < pIn[2] || pSIn[2] > pOut[2])
-        {
-          pSIn = pIn + dIn * farDistIn;
-          distanceEntry = farDistIn;
-        }
-        pSOut = pOut + dOut * nearDistOut;
-        distanceExit = -nearDistOut; // nearDistOut is negative, but distanceExit must be positive
-        if (pSOut[2] < pIn[2] || pSOut[2] > pOut[2])
-        {
-          pSOut = pOut + dOut * farDistOut;
-          distanceExit = -farDistOut;
-        }
+        imgAngleData[idx] += anglex;
+        imgAngleData[idx] += angley;
+        imgAngleSqData[idx] += anglex * anglex;
+        imgAngleSqData[idx] += angley * angley;
       }
     }
+  };
 
-    // Normalize direction with respect to z
-    dIn[0] /= dIn[2];
-    dIn[1] /= dIn[2];
-    // dIn[2] = 1.; SR: implicit in the following
-    dOut[0] /= dOut[2];
-    dOut[1] /= dOut[2];
-    // dOut[2] = 1.; SR: implicit in the following
-
-    // Init MLP before mm to voxel conversion
-    double xIn, xOut, yIn, yOut;
-    double dxIn, dxOut, dyIn, dyOut;
-    if (m_MostLikelyPathTrackerUncertainties)
-    {
-      mlp->InitUncertain(pSIn,
-                         pSOut,
-                         dIn,
-                         dOut,
-                         distanceEntry,
-                         distanceExit,
-                         m_TrackerResolution,
-                         m_TrackerPairSpacing,
-                         m_MaterialBudget);
-      mlp->Evaluate(pSIn[2], xIn, yIn, dxIn, dyIn); // get entrance and exit position according to MLP
-      mlp->Evaluate(pSOut[2], xOut, yOut, dxOut, dyOut);
-    }
-    else
+  // Batch of protons if the path evaluator has a batch version. The path of
+  // the protons of a batch is computed slice by slice for all of them in
+  // lock-step so that the compiler vectorizes the loops over the lanes.
+  constexpr unsigned int VLanes = PathEvaluatorLanes<TPathEvaluator>::value;
+  ProtonBatch<VLanes>    batch;
+
+  auto binBatch = [&](auto & evaluator) {
+    // Unused lanes repeat the first proton to evaluate finite paths, they are not accumulated
+    for (unsigned int l = batch.size; l < VLanes; l++)
     {
-      if (m_MostLikelyPathType == "flexible")
+      for (unsigned int d = 0; d < 3; d++)
       {
-        mlp->Init(pSIn, pSOut, dIn, dOut, eIn, eOut);
+        batch.pIn[d][l] = batch.pIn[d][0];
+        batch.pOut[d][l] = batch.pOut[d][0];
       }
-      else
+      for (unsigned int d = 0; d < 2; d++)
       {
-        mlp->Init(pSIn, pSOut, dIn, dOut);
+        batch.dIn[d][l] = batch.dIn[d][0];
+        batch.dOut[d][l] = batch.dOut[d][0];
       }
-      xIn = pSIn[0];
-      yIn = pSIn[1];
-      xOut = pSOut[0];
-      yOut = pSOut[1];
     }
+    evaluator.InitBatch(batch.pIn, batch.pOut, batch.dIn, batch.dOut);
 
-    std::vector<double>       zmmMLP;
-    std::vector<unsigned int> kMLP;
-    std::vector<double>       xxArr;
-    xxArr.reserve(imgSize[2]);
-    std::vector<double> yyArr;
-    yyArr.reserve(imgSize[2]);
-    double dxDummy, dyDummy;
-
-    double dInMLP[2];
-    if (m_MostLikelyPathTrackerUncertainties && QuadricIntersected)
-    {
-      dInMLP[0] = dxIn;
-      dInMLP[1] = dyIn;
-    }
-    else
-    {
-      dInMLP[0] = dIn[0];
-      dInMLP[1] = dIn[1];
-    }
-
-    double dOutMLP[2];
-    if (m_MostLikelyPathTrackerUncertainties && QuadricIntersected)
-    {
-      dOutMLP[0] = dxOut;
-      dOutMLP[1] = dyOut;
-    }
-    else
-    {
-      dOutMLP[0] = dOut[0];
-      dOutMLP[1] = dOut[1];
-    }
-
-    // loop to populate a vector to be passed to Evaluate if MLP type is elgible
+    double xx[VLanes], yy[VLanes];
+    long   idx[VLanes];
     for (unsigned int k = 0; k < imgSize[2]; k++)
     {
       const double dk = zmm[k];
-      if (dk <= pSIn[2]) // before entrance
-      {
-        const double z = (dk - pSIn[2]);
-        xxArr[k] = xIn + z * dInMLP[0];
-        yyArr[k] = yIn + z * dInMLP[1];
-      }
-      else if (dk >= pSOut[2]) // after exit
+      evaluator.EvaluateBatch(dk, xx, yy);
+      for (unsigned int l = 0; l < VLanes; l++)
       {
-        const double z = (dk - pSOut[2]);
-        xxArr[k] = xOut + z * dOutMLP[0];
-        yyArr[k] = yOut + z * dOutMLP[1];
+        // Straight lines outside the object, before entrance has priority over after exit
+        const double zIn = dk - batch.pIn[2][l];
+        const double zOut = dk - batch.pOut[2][l];
+        double       x = (zOut >= 0.) ? batch.pOut[0][l] + zOut * batch.dOut[0][l] : xx[l];
+        double       y = (zOut >= 0.) ? batch.pOut[1][l] + zOut * batch.dOut[1][l] : yy[l];
+        x = (zIn <= 0.) ? batch.pIn[0][l] + zIn * batch.dIn[0][l] : x;
+        y = (zIn <= 0.) ? batch.pIn[1][l] + zIn * batch.dIn[1][l] : y;
+
+        // Source at (0,0,args_info.source_arg), mag then to voxel and lattice
+        // conversion, floor(x+0.5) is itk::Math::Round
+        const int i = static_cast<int>(std::floor((x * zmag[k] - imgOrigin[0]) * imgSpacingInv[0] + 0.5));
+        const int j = static_cast<int>(std::floor((y * zmag[k] - imgOrigin[1]) * imgSpacingInv[1] + 0.5));
+        const bool inside = i >= 0 && i < (int)imgSize[0] && j >= 0 && j < (int)imgSize[1];
+        idx[l] = inside ? long(i + j * imgSize[0] + k * npixelsPerSlice) : -1;
       }
-      else
+      for (unsigned int l = 0; l < batch.size; l++)
       {
-        if (mlp->m_CanBeVectorised) // maybe more flexible to use a m_CanBeVectorised boolean flag and set it when
-                                    // creating the mlp object
-        {
-          // stock in vector for later if vectorisable
-          zmmMLP.push_back(dk);
-          kMLP.push_back(k);
-        }
-        else
-        {
-          // evaluate directly if not vectorisable
-          mlp->Evaluate(zmm[k], xxArr[k], yyArr[k], dxDummy, dyDummy);
-        }
+        if (idx[l] >= 0)
+          accumulate(k, idx[l], batch.value[l], batch.anglex[l], batch.angley[l]);
       }
     }
+    batch.size = 0;
+  };
 
-    // call Evaluate with vector as argument and insert result into result array
-    // would be prefeable to avoid the copying step and use the xxMLP and yyMLP vectors directly
-    // but that requires the rest of the function further down to be restructured a bit
-    if (mlp->m_CanBeVectorised)
+  // Process pairs chunk by chunk, busyProbe measures the time spent on pairs
+  itk::TimeProbe busyProbe;
+  try
+  {
+    for (unsigned int c = 0; c < m_ProtonPairsReader->GetNumberOfChunks(); c++)
     {
-      std::vector<double> xxMLP;
-      std::vector<double> yyMLP;
-      xxMLP.resize(zmmMLP.size());
-      yyMLP.resize(zmmMLP.size());
+      // The pairs of the chunk are handed out by blocks to the work units
+      // which request them, balancing the load of protons of uneven cost
+      const ProtonPairsImageType::RegionType chunkRegion = m_ProtonPairsReader->GetChunkRegion(c);
+      const itk::SizeValueType               nprotonsInChunk = chunkRegion.GetSize(1);
+      const itk::SizeValueType               blockSize = std::max(itk::SizeValueType(1), m_NumberOfPairsPerBlock);
+      itk::SizeValueType                     first = m_NextPairInChunk[c].fetch_add(blockSize);
+      if (first >= nprotonsInChunk) // All blocks handed out, the chunk may already be freed
+        continue;
+
+      // The chunk is not freed before the block claimed above is released
+      ProtonPairsImagePointer pairs = m_ProtonPairsReader->GetChunk(c);
+      if (pairs.IsNull()) // Reading aborted by another thread
+        return;
 
-      mlp->Evaluate(zmmMLP, xxMLP, yyMLP);
-      for (std::vector<int>::size_type i = 0; i != kMLP.size(); i++)
+      for (; first < nprotonsInChunk; first = m_NextPairInChunk[c].fetch_add(blockSize))
       {
-        xxArr[kMLP[i]] = xxMLP[i];
-        yyArr[kMLP[i]] = yyMLP[i];
-      }
-    }
+        ProtonPairsImageType::RegionType region = chunkRegion;
+        region.SetIndex(1, chunkRegion.GetIndex(1) + first);
+        region.SetSize(1, std::min(blockSize, nprotonsInChunk - first));
 
-    for (unsigned int k = 0; k < imgSize[2]; k++)
-    {
-      double xx, yy;
+        busyProbe.Start();
+        itk::ImageRegionIterator<ProtonPairsImageType> it(pairs, region);
+        while (!it.IsAtEnd())
+        {
+          if (threadId == 0 && it.GetIndex()[1] % 10000 == 0)
+          {
+            std::cout << '\r' << it.GetIndex()[1] << " pairs of protons processed ("
+                      << 100 * it.GetIndex()[1] / nprotons << "%) in thread 1" << std::flush;
+          }
 
-      xx = xxArr[k];
-      yy = yyArr[k];
+          VectorType pIn = it.Get();
+          ++it;
+          VectorType pOut = it.Get();
+          ++it;
+          VectorType dIn = it.Get();
+          ++it;
+          VectorType dOut = it.Get();
+          ++it;
+
+          double anglex = 0., angley = 0.;
+          if (m_ComputeScattering)
+          {
+            using VectorTwoDType = itk::Vector<double, 2>;
+
+            VectorTwoDType dInX, dInY, dOutX, dOutY;
+            dInX[0] = dIn[0];
+            dInX[1] = dIn[2];
+            dInY[0] = dIn[1];
+            dInY[1] = dIn[2];
+            dOutX[0] = dOut[0];
+            dOutX[1] = dOut[2];
+            dOutY[0] = dOut[1];
+            dOutY[1] = dOut[2];
+
+            angley = std::acos(std::min(1., dInY * dOutY / (dInY.GetNorm() * dOutY.GetNorm())));
+            anglex = std::acos(std::min(1., dInX * dOutX / (dInX.GetNorm() * dOutX.GetNorm())));
+          }
 
-      // Source at (0,0,args_info.source_arg), mag then to voxel
-      xx = (xx * zmag[k] - imgOrigin[0]) * imgSpacingInv[0];
-      yy = (yy * zmag[k] - imgOrigin[1]) * imgSpacingInv[1];
+          if (pIn[2] > pOut[2])
+          {
+            // NK: maybe this check should consider the incoming direction of the protons
+            // because pIn > pOut if the beam goes e.g. along -x. That should not cause an exception.
+            itkGenericExceptionMacro("Required condition pIn[2] < pOut[2] is not met, check coordinate system.");
+          }
+          if (dIn[2] < 0.)
+          {
+            itkGenericExceptionMacro("The code assumes that protons move in positive z.");
+          }
 
-      // Lattice conversion
-      const int i = itk::Math::Round<int, double>(xx);
-      const int j = itk::Math::Round<int, double>(yy);
-      if (i >= 0 && i < (int)imgSize[0] && j >= 0 && j < (int)imgSize[1])
-      {
-        const unsigned long idx = i + j * imgSize[0] + k * npixelsPerSlice;
-        imgData[idx] += value;
-        if (m_ComputeNoise)
-        {
-          imgSquaredData[idx] += value * value;
-        }
-        imgCountData[idx]++;
-        if (m_ComputeScattering)
-        {
-          if (m_Robust)
+          const double eIn = it.Get()[0];
+          const double eOut = it.Get()[1];
+          double       value = 0.;
+          if (eIn == 0.)
+          {
+            if (std::is_same<TMostLikelyPath, EnergyAdaptiveMLPFunction>::value)
+            {
+              itkGenericExceptionMacro(
+                "The energy adaptive MLP is not supported if WEPL values are directed provided instead of energy.");
+            }
+            value = eOut; // Directly read WEPL
+          }
+          else
+          {
+            value = m_ConvFunc->GetValue(eOut, eIn); // convert to WEPL
+          }
+          ++it;
+
+          VectorType nucInfo(0.);
+          if (it.GetIndex()[0] != 0)
+          {
+            nucInfo = it.Get();
+            ++it;
+          }
+
+          // Move straight to entrance and exit shapes
+
+
+          VectorType pSIn = pIn;
+          VectorType pSOut = pOut;
+          double     nearDistIn, nearDistOut, farDistIn, farDistOut;
+          double     distanceEntry, distanceExit;
+          bool       QuadricIntersected = false;
+          if (m_QuadricIn.GetPointer() != NULL)
+          {
+            if (m_QuadricIn->IsIntersectedByRay(pIn, dIn, nearDistIn, farDistIn) &&
+                m_QuadricOut->IsIntersectedByRay(pOut, dOut, farDistOut, nearDistOut))
+            {
+              QuadricIntersected = true;
+              pSIn = pIn + dIn * nearDistIn;
+              distanceEntry = nearDistIn;
+              if (pSIn[2] < pIn[2] || pSIn[2] > pOut[2])
+              {
+                pSIn = pIn + dIn * farDistIn;
+                distanceEntry = farDistIn;
+              }
+              pSOut = pOut + dOut * nearDistOut;
+              distanceExit = -nearDistOut; // nearDistOut is negative, but distanceExit must be positive
+              if (pSOut[2] < pIn[2] || pSOut[2] > pOut[2])
+              {
+                pSOut = pOut + dOut * farDistOut;
+                distanceExit = -farDistOut;
+              }
+            }
+          }
+
+          // Normalize direction with respect to z
+          dIn[0] /= dIn[2];
+          dIn[1] /= dIn[2];
+          // dIn[2] = 1.; SR: implicit in the following
+          dOut[0] /= dOut[2];
+          dOut[1] /= dOut[2];
+          // dOut[2] = 1.; SR: implicit in the following
+
+          // Gather the proton in the batch, binned when the batch is full
+          if constexpr (VLanes > 1)
+          {
+            const unsigned int l = batch.size++;
+            for (unsigned int d = 0; d < 3; d++)
+            {
+              batch.pIn[d][l] = pSIn[d];
+              batch.pOut[d][l] = pSOut[d];
+            }
+            for (unsigned int d = 0; d < 2; d++)
+            {
+              batch.dIn[d][l] = dIn[d];
+              batch.dOut[d][l] = dOut[d];
+            }
+            batch.value[l] = value;
+            batch.anglex[l] = anglex;
+            batch.angley[l] = angley;
+            if (batch.size == VLanes)
+              binBatch(evaluatePath);
+            continue;
+          }
+
+          // Init MLP before mm to voxel conversion
+          double xIn, xOut, yIn, yOut;
+          double dxIn, dxOut, dyIn, dyOut;
+          if (m_MostLikelyPathTrackerUncertainties)
+          {
+            mlp->InitUncertain(pSIn,
+                               pSOut,
+                               dIn,
+                               dOut,
+                               distanceEntry,
+                               distanceExit,
+                               m_TrackerResolution,
+                               m_TrackerPairSpacing,
+                               m_MaterialBudget);
+            mlp->Evaluate(pSIn[2], xIn, yIn, dxIn, dyIn); // get entrance and exit position according to MLP
+            mlp->Evaluate(pSOut[2], xOut, yOut, dxOut, dyOut);
+          }
+          else
+          {
+            InitMostLikelyPath(mlp, pSIn, pSOut, dIn, dOut, eIn, eOut);
+            xIn = pSIn[0];
+            yIn = pSIn[1];
+            xOut = pSOut[0];
+            yOut = pSOut[1];
+          }
+
+          double dInMLP[2];
+          if (m_MostLikelyPathTrackerUncertainties && QuadricIntersected)
           {
-            m_AnglesVectorsMutex.lock();
-            m_AnglesVectors[idx].push_back(anglex);
-            m_AnglesVectors[idx].push_back(angley);
-            m_AnglesVectorsMutex.unlock();
+            dInMLP[0] = dxIn;
+            dInMLP[1] = dyIn;
           }
           else
           {
-            imgAngleData[idx] += anglex;
-            imgAngleData[idx] += angley;
-            imgAngleSqData[idx] += anglex * anglex;
-            imgAngleSqData[idx] += angley * angley;
+            dInMLP[0] = dIn[0];
+            dInMLP[1] = dIn[1];
+          }
+
+          double dOutMLP[2];
+          if (m_MostLikelyPathTrackerUncertainties && QuadricIntersected)
+          {
+            dOutMLP[0] = dxOut;
+            dOutMLP[1] = dyOut;
+          }
+          else
+          {
+            dOutMLP[0] = dOut[0];
+            dOutMLP[1] = dOut[1];
+          }
+
+          // Straight lines outside the object and MLP inside. The slices inside
+          // are contiguous and evaluated at once in the path buffers.
+          unsigned int kFirstMLP = imgSize[2], kLastMLP = 0;
+          for (unsigned int k = 0; k < imgSize[2]; k++)
+          {
+            const double dk = zmm[k];
+            if (dk <= pSIn[2]) // before entrance
+            {
+              const double z = (dk - pSIn[2]);
+              xxArr[k] = xIn + z * dInMLP[0];
+              yyArr[k] = yIn + z * dInMLP[1];
+            }
+            else if (dk >= pSOut[2]) // after exit
+            {
+              const double z = (dk - pSOut[2]);
+              xxArr[k] = xOut + z * dOutMLP[0];
+              yyArr[k] = yOut + z * dOutMLP[1];
+            }
+            else
+            {
+              kFirstMLP = std::min(kFirstMLP, k);
+              kLastMLP = k;
+            }
+          }
+          if (kFirstMLP <= kLastMLP)
+          {
+            const size_t nMLP = kLastMLP - kFirstMLP + 1;
+            evaluatePath(zmm.data() + kFirstMLP, nMLP, xxArr.data() + kFirstMLP, yyArr.data() + kFirstMLP);
+          }
+
+          for (unsigned int k = 0; k < imgSize[2]; k++)
+          {
+            double xx, yy;
+
+            xx = xxArr[k];
+            yy = yyArr[k];
+
+            // Source at (0,0,args_info.source_arg), mag then to voxel
+            xx = (xx * zmag[k] - imgOrigin[0]) * imgSpacingInv[0];
+            yy = (yy * zmag[k] - imgOrigin[1]) * imgSpacingInv[1];
+
+            // Lattice conversion
+            const int i = itk::Math::Round<int, double>(xx);
+            const int j = itk::Math::Round<int, double>(yy);
+            if (i >= 0 && i < (int)imgSize[0] && j >= 0 && j < (int)imgSize[1])
+              accumulate(k, i + j * imgSize[0] + k * npixelsPerSlice, value, anglex, angley);
           }
         }
+        busyProbe.Stop();
+        m_WorkUnitNumberOfPairs[threadId] += region.GetSize(1);
+        m_ProtonPairsReader->ReleasePairs(c, region.GetSize(1));
       }
     }
+
+    // Bin the protons of the last incomplete batch
+    if constexpr (VLanes > 1)
+    {
+      if (batch.size)
+        binBatch(evaluatePath);
+    }
+
+    // Apply the remaining buffered updates
+    for (unsigned int slab = 0; slab < slabUpdates.size(); slab++)
+      this->FlushVoxelUpdates(slab, slabUpdates[slab]);
+  }
+  catch (...)
+  {
+    // Wake up the other threads waiting for a chunk that will never be released
+    m_ProtonPairsReader->Abort();
+    throw;
   }
 
+  m_WorkUnitBusyTimes[threadId] = busyProbe.GetTotal();
+
   if (threadId == 0)
   {
-    std::cout << '\r' << region.GetSize(1) << " pairs of protons processed (100%) in thread 1" << std::endl;
+    std::cout << '\r' << nprotons << " pairs of protons processed (100%)" << std::endl;
 #ifdef MLP_TIMING
     mlp->PrintTiming(std::cout);
 #endif
@@ -466,161 +645,276 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ThreadedGenera
 
 template <class TInputImage, class TOutputImage>
 void
-ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::AfterThreadedGenerateData()
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::AllocateAccumulationImages(const unsigned int i)
 {
-  using ImageIteratorType = typename itk::ImageRegionIterator<TOutputImage>;
-  ImageIteratorType itOut(m_Outputs[0], m_Outputs[0]->GetLargestPossibleRegion());
+  // Create thread image and corresponding stack to count events
+  m_Counts[i] = CountImageType::New();
+  m_Counts[i]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+  m_Counts[i]->Allocate();
+  m_Counts[i]->FillBuffer(0);
 
-  using ImageCountIteratorType = itk::ImageRegionIterator<CountImageType>;
-  ImageCountIteratorType itCOut(m_Counts[0], m_Outputs[0]->GetLargestPossibleRegion());
+  if (m_ComputeScattering &&
+      (!m_Robust || i == 0)) // Note NK: is this condition correct? Should it not be !(m_Robust || i==0) ?
+  {
+    m_Angles[i] = AngleImageType::New();
+    m_Angles[i]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+    m_Angles[i]->Allocate();
+    m_Angles[i]->FillBuffer(0);
+
+    m_AnglesSq[i] = AngleImageType::New();
+    m_AnglesSq[i]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+    m_AnglesSq[i]->Allocate();
+    m_AnglesSq[i]->FillBuffer(0);
+  }
 
-  // Merge the projection computed in each thread to the first one
-  for (unsigned int i = 1; i < this->GetNumberOfWorkUnits(); i++)
+  if (m_ComputeNoise)
   {
-    if (m_Outputs[i].GetPointer() == NULL)
-      continue;
-    ImageIteratorType      itOutThread(m_Outputs[i], m_Outputs[i]->GetLargestPossibleRegion());
-    ImageCountIteratorType itCOutThread(m_Counts[i], m_Outputs[i]->GetLargestPossibleRegion());
+    m_SquaredOutputs[i] = OutputImageType::New();
+    m_SquaredOutputs[i]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+    m_SquaredOutputs[i]->Allocate();
+    m_SquaredOutputs[i]->FillBuffer(0);
+  }
 
-    while (!itOut.IsAtEnd())
+  if (i == 0)
+  {
+    m_Outputs[0] = this->GetOutput();
+    m_Count = m_Counts[0];
+    if (m_ComputeScattering)
     {
-      itOut.Set(itOut.Get() + itOutThread.Get());
-      ++itOutThread;
-      ++itOut;
-
-      itCOut.Set(itCOut.Get() + itCOutThread.Get());
-      ++itCOutThread;
-      ++itCOut;
+      m_Angle = m_Angles[0];
+      m_AngleSq = m_AnglesSq[0];
     }
-
-    itOut.GoToBegin();
-    itCOut.GoToBegin();
+    if (m_ComputeNoise)
+      m_SquaredOutput = m_SquaredOutputs[0];
   }
+  else
+  {
+    m_Outputs[i] = OutputImageType::New();
+    m_Outputs[i]->SetRegions(this->GetInput()->GetLargestPossibleRegion());
+    m_Outputs[i]->Allocate();
+  }
+  m_Outputs[i]->FillBuffer(0.);
+}
 
-  // Set count image information
-  m_Count->SetSpacing(this->GetOutput()->GetSpacing());
-  m_Count->SetOrigin(this->GetOutput()->GetOrigin());
+template <class TInputImage, class TOutputImage>
+void
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::FlushVoxelUpdates(
+  const unsigned int         slab,
+  std::vector<VoxelUpdate> & updates)
+{
+  typename OutputImageType::PixelType * imgData = m_Outputs[0]->GetBufferPointer();
+  unsigned int *                        imgCountData = m_Counts[0]->GetBufferPointer();
 
-  // Normalize eloss wepl with proton count (average)
-  while (!itCOut.IsAtEnd())
+  std::lock_guard<std::mutex> lock(m_SlabMutexes[slab]);
+  for (const VoxelUpdate & u : updates)
   {
-    if (itCOut.Get())
-      itOut.Set(itOut.Get() / itCOut.Get());
-    ++itOut;
-    ++itCOut;
+    imgData[u.idx] += u.value;
+    imgCountData[u.idx]++;
   }
-
   if (m_ComputeNoise)
   {
-    ImageIteratorType itSqOut(m_SquaredOutputs[0], m_Outputs[0]->GetLargestPossibleRegion());
-    for (unsigned int i = 1; i < this->GetNumberOfWorkUnits(); i++)
+    typename OutputImageType::PixelType * imgSquaredData = m_SquaredOutputs[0]->GetBufferPointer();
+    for (const VoxelUpdate & u : updates)
+      imgSquaredData[u.idx] += u.value * u.value;
+  }
+  if (m_ComputeScattering && !m_Robust)
+  {
+    float * imgAngleData = m_Angles[0]->GetBufferPointer();
+    float * imgAngleSqData = m_AnglesSq[0]->GetBufferPointer();
+    for (const VoxelUpdate & u : updates)
     {
-      if (m_SquaredOutputs[i].GetPointer() == NULL)
-        continue;
-      ImageIteratorType itSqOutThread(m_SquaredOutputs[i], m_Outputs[i]->GetLargestPossibleRegion());
-      while (!itSqOut.IsAtEnd())
-      {
-        itSqOut.Set(itSqOut.Get() + itSqOutThread.Get());
-        ++itSqOutThread;
-        ++itSqOut;
-      }
-      itSqOut.GoToBegin();
+      imgAngleData[u.idx] += u.anglex;
+      imgAngleData[u.idx] += u.angley;
+      imgAngleSqData[u.idx] += u.anglex * u.anglex;
+      imgAngleSqData[u.idx] += u.angley * u.angley;
     }
+  }
+  updates.clear();
+}
 
-    m_SquaredOutput->SetSpacing(this->GetOutput()->GetSpacing());
-    m_SquaredOutput->SetOrigin(this->GetOutput()->GetOrigin());
-
-    // Calculate RMSE of WEPL
-    itCOut.GoToBegin();
-    itOut.GoToBegin();
-    while (!itCOut.IsAtEnd())
-    {
-      if (itCOut.Get())
+template <class TInputImage, class TOutputImage>
+void
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::ComputeRobustScattering()
+{
+  const typename OutputImageType::SizeType imgSize = m_Angles[0]->GetBufferedRegion().GetSize();
+  const unsigned long                      npixelsPerSlice = imgSize[0] * imgSize[1];
+
+  // Each slab is processed independently: the angles of the work units are
+  // gathered by voxel with a counting sort and the quantile of each voxel is
+  // then selected in place
+  this->GetMultiThreader()->ParallelizeArray(
+    0,
+    m_NumberOfSlabs,
+    [&](itk::SizeValueType slab) {
+      const unsigned int  firstSlice = slab * m_SlicesPerSlab;
+      const unsigned int  nslices = std::min<unsigned int>(m_SlicesPerSlab, imgSize[2] - firstSlice);
+      const unsigned long nvoxels = nslices * npixelsPerSlice;
+
+      // The number of angles of a slab may exceed 32 bits with large pair files
+      std::vector<itk::SizeValueType> offsets(nvoxels + 1, 0);
+      for (auto & threadAngles : m_RobustAngles)
+        for (const RobustAngle & a : threadAngles[slab])
+          offsets[a.voxel + 1] += 2;
+      for (unsigned long v = 0; v < nvoxels; v++)
+        offsets[v + 1] += offsets[v];
+      if (offsets[nvoxels] == 0)
+        return;
+
+      std::vector<float>              angles(offsets[nvoxels]);
+      std::vector<itk::SizeValueType> cursors(offsets.begin(), offsets.end() - 1);
+      for (auto & threadAngles : m_RobustAngles)
       {
-        itSqOut.Set(itSqOut.Get() / itCOut.Get());
-        itSqOut.Set(itSqOut.Get() - itOut.Get() * itOut.Get()); // Subtract mean value to get mean sqaure error (MSE)
-        itSqOut.Set(itSqOut.Get() / itCOut.Get());              // devide by counts to get MSE of the mean value
+        for (const RobustAngle & a : threadAngles[slab])
+        {
+          angles[cursors[a.voxel]++] = a.anglex;
+          angles[cursors[a.voxel]++] = a.angley;
+        }
+        std::vector<RobustAngle>().swap(threadAngles[slab]);
       }
-      ++itSqOut;
-      ++itOut;
-      ++itCOut;
-    }
-  }
 
-  if (m_ComputeScattering)
-  {
-    using ImageAngleIteratorType = itk::ImageRegionIterator<AngleImageType>;
-    ImageAngleIteratorType itAngleOut(m_Angles[0], m_Outputs[0]->GetLargestPossibleRegion());
-
-    using ImageAngleSqIteratorType = itk::ImageRegionIterator<AngleImageType>;
-    ImageAngleSqIteratorType itAngleSqOut(m_AnglesSq[0], m_Outputs[0]->GetLargestPossibleRegion());
-
-    if (!m_Robust)
-    {
-      for (unsigned int i = 1; i < this->GetNumberOfWorkUnits(); i++)
+      float * imgAngleData = m_Angles[0]->GetBufferPointer() + firstSlice * npixelsPerSlice;
+      for (unsigned long v = 0; v < nvoxels; v++)
       {
-        if (m_Outputs[i].GetPointer() == NULL)
+        const itk::SizeValueType n = offsets[v + 1] - offsets[v];
+        if (n == 0)
           continue;
-        ImageAngleIteratorType   itAngleOutThread(m_Angles[i], m_Outputs[i]->GetLargestPossibleRegion());
-        ImageAngleSqIteratorType itAngleSqOutThread(m_AnglesSq[i], m_Outputs[i]->GetLargestPossibleRegion());
-
-        while (!itAngleOut.IsAtEnd())
+        if (n == 2) // A single proton
         {
-          itAngleOut.Set(itAngleOut.Get() + itAngleOutThread.Get());
-          ++itAngleOutThread;
-          ++itAngleOut;
-
-          itAngleSqOut.Set(itAngleSqOut.Get() + itAngleSqOutThread.Get());
-          ++itAngleSqOutThread;
-          ++itAngleSqOut;
+          imgAngleData[v] = 0.;
+          continue;
         }
-        itAngleOut.GoToBegin();
-        itAngleSqOut.GoToBegin();
-      }
-    }
 
-    // Set scattering wepl image information
-    m_Angle->SetSpacing(this->GetOutput()->GetSpacing());
-    m_Angle->SetOrigin(this->GetOutput()->GetOrigin());
+        // Angle: 38.30% (0.5 sigma) with interpolation (median is 0. and we only have positive values
+        const std::vector<float>::iterator first = angles.begin() + offsets[v];
+        const std::vector<float>::iterator last = angles.begin() + offsets[v + 1];
+        double                             sigmaAPos = n * 0.3830;
+        itk::SizeValueType                 sigmaASupPos = itk::Math::Ceil<itk::SizeValueType, double>(sigmaAPos);
+        std::nth_element(first, first + sigmaASupPos, last);
+        const float sup = *(first + sigmaASupPos);
+        const float inf = *std::max_element(first, first + sigmaASupPos);
+        double      sigmaADiff = sigmaASupPos - sigmaAPos;
+        double      sigma = 2. * (sup * (1. - sigmaADiff) + inf * sigmaADiff); // x2 to get 1sigma
+        imgAngleData[v] = sigma * sigma;
+      }
+    },
+    nullptr);
+}
 
-    itCOut.GoToBegin();
-    std::vector<std::vector<float>>::iterator itAnglesVectors = m_AnglesVectors.begin();
-    while (!itCOut.IsAtEnd())
+template <class TInputImage, class TOutputImage>
+void
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::AfterThreadedGenerateData()
+{
+  m_ThreadedProbe.Stop();
+  m_ProtonPairsReader->Stop();
+  m_ProtonPairsReader = nullptr;
+
+  // Buffers of the work units which have accumulated their own images
+  using PixelType = typename OutputImageType::PixelType;
+  std::vector<const PixelType *>    threadData, threadSquaredData;
+  std::vector<const unsigned int *> threadCountData;
+  std::vector<const float *>        threadAngleData, threadAngleSqData;
+  for (unsigned int i = 1; i < m_Outputs.size(); i++)
+  {
+    if (m_Outputs[i].GetPointer() == NULL)
+      continue;
+    threadData.push_back(m_Outputs[i]->GetBufferPointer());
+    threadCountData.push_back(m_Counts[i]->GetBufferPointer());
+    if (m_ComputeNoise)
+      threadSquaredData.push_back(m_SquaredOutputs[i]->GetBufferPointer());
+    if (m_ComputeScattering && !m_Robust)
     {
-      if (itCOut.Get())
+      threadAngleData.push_back(m_Angles[i]->GetBufferPointer());
+      threadAngleSqData.push_back(m_AnglesSq[i]->GetBufferPointer());
+    }
+  }
+
+  // Single parallel pass over the volume, one line at a time so that the line
+  // of each thread buffer is summed and normalized while it is in cache
+  const typename OutputImageType::RegionType region = m_Outputs[0]->GetLargestPossibleRegion();
+  this->GetMultiThreader()->template ParallelizeImageRegion<OutputImageType::ImageDimension>(
+    region,
+    [&](const OutputImageRegionType & outputRegionForThread) {
+      PixelType *    imgData = m_Outputs[0]->GetBufferPointer();
+      unsigned int * imgCountData = m_Counts[0]->GetBufferPointer();
+      PixelType *    imgSquaredData = (m_ComputeNoise) ? m_SquaredOutputs[0]->GetBufferPointer() : NULL;
+      float *        imgAngleData = (m_ComputeScattering) ? m_Angles[0]->GetBufferPointer() : NULL;
+      float *        imgAngleSqData = (m_ComputeScattering && !m_Robust) ? m_AnglesSq[0]->GetBufferPointer() : NULL;
+
+      const size_t                                    lineLength = outputRegionForThread.GetSize(0);
+      itk::ImageScanlineConstIterator<CountImageType> itLine(m_Counts[0], outputRegionForThread);
+      while (!itLine.IsAtEnd())
       {
-        // Calculate angular variance (sigma2) and convert to scattering wepl
-        if (m_Robust)
+        const size_t first = m_Counts[0]->ComputeOffset(itLine.GetIndex());
+        const size_t last = first + lineLength;
+
+        // Merge the images computed in each thread to the first one
+        for (unsigned int t = 0; t < threadData.size(); t++)
         {
-          if (itCOut.Get() == 1)
+          for (size_t idx = first; idx < last; idx++)
           {
-            itAngleOut.Set(0.);
+            imgData[idx] += threadData[t][idx];
+            imgCountData[idx] += threadCountData[t][idx];
           }
-          else
+          if (m_ComputeNoise)
           {
-            // Angle: 38.30% (0.5 sigma) with interpolation (median is 0. and we only have positive values
-            double       sigmaAPos = itAnglesVectors->size() * 0.3830;
-            unsigned int sigmaASupPos = itk::Math::Ceil<unsigned int, double>(sigmaAPos);
-            std::partial_sort(
-              itAnglesVectors->begin(), itAnglesVectors->begin() + sigmaASupPos + 1, itAnglesVectors->end());
-            double sigmaADiff = sigmaASupPos - sigmaAPos;
-            double sigma = 2. * (*(itAnglesVectors->begin() + sigmaASupPos) * (1. - sigmaADiff) +
-                                 *(itAnglesVectors->begin() + sigmaASupPos - 1) * sigmaADiff); // x2 to get 1sigma
-            itAngleOut.Set(sigma * sigma);
+            for (size_t idx = first; idx < last; idx++)
+              imgSquaredData[idx] += threadSquaredData[t][idx];
+          }
+          if (m_ComputeScattering && !m_Robust)
+          {
+            for (size_t idx = first; idx < last; idx++)
+            {
+              imgAngleData[idx] += threadAngleData[t][idx];
+              imgAngleSqData[idx] += threadAngleSqData[t][idx];
+            }
           }
         }
-        else
+
+        for (size_t idx = first; idx < last; idx++)
         {
-          double sigma2 = itAngleSqOut.Get() / itCOut.Get() / 2;
-          itAngleOut.Set(sigma2);
+          const unsigned int count = imgCountData[idx];
+          if (!count)
+            continue;
+
+          // Normalize eloss wepl with proton count (average)
+          imgData[idx] /= count;
+
+          // Calculate RMSE of WEPL
+          if (m_ComputeNoise)
+          {
+            imgSquaredData[idx] /= count;
+            imgSquaredData[idx] -= imgData[idx] * imgData[idx]; // Subtract mean value to get mean sqaure error (MSE)
+            imgSquaredData[idx] /= count;                       // devide by counts to get MSE of the mean value
+          }
+
+          // Calculate angular variance (sigma2) and convert to scattering wepl, see
+          // ComputeRobustScattering for the robust estimation
+          if (m_ComputeScattering)
+          {
+            if (!m_Robust)
+              imgAngleData[idx] = imgAngleSqData[idx] / count / 2;
+          }
         }
+        itLine.NextLine();
       }
+    },
+    nullptr);
 
-      ++itCOut;
-      ++itAngleOut;
-      ++itAngleSqOut;
-      ++itAnglesVectors;
-    }
+  if (m_ComputeScattering && m_Robust)
+    this->ComputeRobustScattering();
+
+  // Set count, noise and scattering image information
+  m_Count->SetSpacing(this->GetOutput()->GetSpacing());
+  m_Count->SetOrigin(this->GetOutput()->GetOrigin());
+  if (m_ComputeNoise)
+  {
+    m_SquaredOutput->SetSpacing(this->GetOutput()->GetSpacing());
+    m_SquaredOutput->SetOrigin(this->GetOutput()->GetOrigin());
+  }
+  if (m_ComputeScattering)
+  {
+    m_Angle->SetSpacing(this->GetOutput()->GetSpacing());
+    m_Angle->SetOrigin(this->GetOutput()->GetOrigin());
   }
 
   // Free images created in threads
@@ -629,7 +923,22 @@ ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::AfterThreadedG
   m_Counts.resize(0);
   m_Angles.resize(0);
   m_AnglesSq.resize(0);
-  m_AnglesVectors.resize(0);
+  m_RobustAngles.resize(0);
+}
+
+template <class TInputImage, class TOutputImage>
+void
+ProtonPairsToDistanceDrivenProjection<TInputImage, TOutputImage>::PrintTiming(std::ostream & os) const
+{
+  os << "ProtonPairsToDistanceDrivenProjection timing:" << std::endl;
+  os << "  Pair processing: " << m_ThreadedProbe.GetTotal() << ' ' << m_ThreadedProbe.GetUnit() << std::endl;
+  for (unsigned int i = 0; i < m_WorkUnitBusyTimes.size(); i++)
+  {
+    const double utilization =
+      (m_ThreadedProbe.GetTotal() > 0.) ? 100. * m_WorkUnitBusyTimes[i] / m_ThreadedProbe.GetTotal() : 0.;
+    os << "  Work unit " << i << ": " << m_WorkUnitNumberOfPairs[i] << " pairs, " << m_WorkUnitBusyTimes[i] << ' '
+       << m_ThreadedProbe.GetUnit() << " busy (" << utilization << "% utilization)" << std::endl;
+  }
 }
 
 } // namespace pct
@@ -132,6 +132,76 @@ public:
 
 } // end namespace Functor
 
+/** \class SchulteMLPTable
+ * \brief Weights of the Schulte MLP precomputed on a regular grid.
+ *
+ * For given depth u1 and length u2, the MLP without tracker uncertainties is
+ * linear in the entrance and exit parameters (x0, theta0, x2, theta2). The
+ * table stores the four weights of the position followed by the four weights
+ * of the direction on a grid of lengths u2 and relative depths u1/u2. It is
+ * computed once and shared by the SchulteMLPFunction of all threads.
+ *
+ * \ingroup Functions PCT
+ */
+class PCT_EXPORT SchulteMLPTable : public itk::LightObject
+{
+public:
+  /** Standard class typedefs. */
+  using Self = SchulteMLPTable;
+  using Superclass = itk::LightObject;
+  using Pointer = itk::SmartPointer<Self>;
+  using ConstPointer = itk::SmartPointer<const Self>;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  using WeightsType = itk::Vector<double, 8>;
+
+  /** Compute the weights for lengths up to maxLength. The grid has the same
+   * number of samples, maxLength / step + 1, in both directions. */
+  void
+  Compute(const double maxLength, const double step);
+
+  double
+  GetMaxLength() const
+  {
+    return m_MaxLength;
+  }
+
+  double
+  GetStep() const
+  {
+    return m_Step;
+  }
+
+  unsigned int
+  GetNumberOfSamples() const
+  {
+    return m_NumberOfSamples;
+  }
+
+  /** Weights of the l-th length and all relative depths. */
+  const WeightsType *
+  GetRow(const unsigned int l) const
+  {
+    return m_Weights.data() + l * m_NumberOfSamples;
+  }
+
+protected:
+  SchulteMLPTable() {}
+  ~SchulteMLPTable() {}
+
+private:
+  SchulteMLPTable(const Self &); // purposely not implemented
+  void
+  operator=(const Self &); // purposely not implemented
+
+  double                   m_MaxLength = 0.;
+  double                   m_Step = 1.;
+  unsigned int             m_NumberOfSamples = 0;
+  std::vector<WeightsType> m_Weights;
+};
+
 /** \class SchulteMLPFunction
  * \brief See [Schulte, Med Phys, 2008].
  *
@@ -172,10 +242,29 @@ public:
   virtual void
   Evaluate(const double u1, double & x, double & y, double & dx, double & dy) override;
 
+  /** Vectorised version of Evaluate function with closed-form 2x2 algebra. */
+  using Superclass::Evaluate;
+  virtual void
+  Evaluate(const double * u, const size_t n, double * x, double * y) override;
+
   /** Evaluate the error (x,y) (equation 27) at depth z. */
   void
   EvaluateError(const double u1, itk::Matrix<double, 2, 2> & error);
 
+  /** Weights of the MLP without tracker uncertainties at depth u1 for a
+   * length u2 (equations 6-18), see SchulteMLPTable. */
+  static void
+  ComputeWeights(const double u1, const double u2, SchulteMLPTable::WeightsType & w);
+
+  /** Set a table of precomputed weights. It is used instead of the scattering
+   * matrices for the protons shorter than its maximum length and without
+   * tracker uncertainties. Default is none. */
+  void
+  SetTable(const SchulteMLPTable * table)
+  {
+    m_Table = table;
+  }
+
 #ifdef MLP_TIMING
   /** Print timing information */
   virtual void
@@ -184,9 +273,13 @@ public:
 
 protected:
   /// Implementation of 2x2 matrix inversion, faster than itk/vnl inversion
-  void
+  static void
   InverseMatrix(itk::Matrix<double, 2, 2> & mat);
 
+  /// Evaluate with the table, u1 relative to the entrance
+  void
+  EvaluateFromTable(const double u1, double & x, double & y, double & dx, double & dy) const;
+
   /// Constructor
   SchulteMLPFunction();
 
@@ -219,7 +312,15 @@ private:
   itk::Matrix<double, 2, 2> m_Sigma1;
   itk::Matrix<double, 2, 2> m_Sigma2;
 
-  bool m_considerTrackerUncertainties;
+  bool m_considerTrackerUncertainties = false;
+
+  // Table of weights and the two rows surrounding m_u2 with their interpolation weight
+  SchulteMLPTable::ConstPointer        m_Table;
+  bool                                 m_UseTable = false;
+  const SchulteMLPTable::WeightsType * m_TableRow0 = nullptr;
+  const SchulteMLPTable::WeightsType * m_TableRow1 = nullptr;
+  double                               m_TableRowWeight;
+  double                               m_TableDepthScale;
 
   // Addtional matrices needed for MLP with tracker uncertainties
   itk::Matrix<double, 2, 2> m_SigmaIn;
@@ -35,9 +35,14 @@ public:
   virtual void
   Evaluate(const TCoordRep z, TCoordRep & x, TCoordRep & y, TCoordRep & dx, TCoordRep & dy) override;
 
+  /** Vectorised version of Evaluate function. */
+  using Superclass::Evaluate;
+  virtual void
+  Evaluate(const TCoordRep * u, const size_t n, TCoordRep * x, TCoordRep * y) override;
+
 protected:
   /// Constructor
-  ThirdOrderPolynomialMLPFunction() {}
+  ThirdOrderPolynomialMLPFunction();
 
   /// Destructor
   ~ThirdOrderPolynomialMLPFunction() {}
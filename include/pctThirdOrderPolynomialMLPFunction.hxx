@@ -28,17 +28,41 @@ ThirdOrderPolynomialMLPFunction<TCoordRep>::Init(const VectorType posIn,
   dy = inv3zsq * (yd - by - 2 * cy * lastSliceZ);
 }
 
+template <class TCoordRep>
+ThirdOrderPolynomialMLPFunction<TCoordRep>::ThirdOrderPolynomialMLPFunction()
+{
+  this->m_CanBeVectorised = true;
+}
+
 template <class TCoordRep>
 void
 ThirdOrderPolynomialMLPFunction<TCoordRep>::Evaluate(const TCoordRep z,
                                                      TCoordRep &     x,
                                                      TCoordRep &     y,
-                                                     TCoordRep &     dx,
-                                                     TCoordRep &     dy)
+                                                     TCoordRep &     xd,
+                                                     TCoordRep &     yd)
 {
   const TCoordRep zz = (z - zoffset);
   x = ax + zz * (bx + zz * (cx + zz * dx));
   y = ay + zz * (by + zz * (cy + zz * dy));
+  xd = bx + zz * (2 * cx + zz * 3 * dx);
+  yd = by + zz * (2 * cy + zz * 3 * dy);
+}
+
+template <class TCoordRep>
+void
+ThirdOrderPolynomialMLPFunction<TCoordRep>::Evaluate(const TCoordRep * u,
+                                                     const size_t      n,
+                                                     TCoordRep *       x,
+                                                     TCoordRep *       y)
+{
+  // Independent iterations without branch, vectorized by the compiler
+  for (size_t i = 0; i < n; i++)
+  {
+    const TCoordRep zz = (u[i] - zoffset);
+    x[i] = ax + zz * (bx + zz * (cx + zz * dx));
+    y[i] = ay + zz * (by + zz * (cy + zz * dy));
+  }
 }
 
 } // namespace pct
@@ -9,6 +9,8 @@
  * \ingroup PCT
  * From an input 4D image where the 4th dimension is the angle, computes
  * the weighted backprojection for DBP described in [Zeng, Med Phys, 2007].
+ * The input requested region covers all angles of the output requested
+ * region so that the filter can be streamed along the spatial dimensions.
  *
  * \author Simon Rit
  */
@@ -44,6 +46,10 @@ protected:
   virtual void
   GenerateOutputInformation() override;
   virtual void
+  GenerateInputRequestedRegion() override;
+  virtual void
+  BeforeThreadedGenerateData() override;
+  virtual void
   DynamicThreadedGenerateData(const OutputImageRegionType & outputRegionForThread) override;
 
   using Superclass::MakeOutput;
@@ -54,6 +60,10 @@ private:
   ZengBackProjectionImageFilter(const Self &); // purposely not implemented
   void
   operator=(const Self &); // purposely not implemented
+
+  /** Signed cosine and sine weights of each angle, including the angular spacing */
+  std::vector<double> m_CosWeights;
+  std::vector<double> m_SinWeights;
 }; // end of class
 
 } // end namespace pct
@@ -5,6 +5,8 @@
 #include <itkMacro.h>
 #include <itkImageRegionIteratorWithIndex.h>
 
+#include <algorithm>
+
 namespace pct
 {
 
@@ -36,7 +38,48 @@ ZengBackProjectionImageFilter<TInputImage, TOutputImage>::GenerateOutputInformat
   {
     this->GetOutput(i)->SetSpacing(spacing);
     this->GetOutput(i)->SetOrigin(origin);
-    this->GetOutput(i)->SetRegions(region);
+    this->GetOutput(i)->SetLargestPossibleRegion(region);
+  }
+}
+
+template <class TInputImage, class TOutputImage>
+void
+ZengBackProjectionImageFilter<TInputImage, TOutputImage>::GenerateInputRequestedRegion()
+{
+  typename TInputImage::Pointer inputPtr = const_cast<TInputImage *>(this->GetInput());
+  if (!inputPtr)
+    return;
+
+  // Same spatial region as the output, all angles
+  typename TInputImage::RegionType reqRegion = inputPtr->GetLargestPossibleRegion();
+  for (unsigned int i = 0; i < TOutputImage::ImageDimension; i++)
+  {
+    reqRegion.SetIndex(i, this->GetOutput()->GetRequestedRegion().GetIndex(i));
+    reqRegion.SetSize(i, this->GetOutput()->GetRequestedRegion().GetSize(i));
+  }
+  inputPtr->SetRequestedRegion(reqRegion);
+}
+
+template <class TInputImage, class TOutputImage>
+void
+ZengBackProjectionImageFilter<TInputImage, TOutputImage>::BeforeThreadedGenerateData()
+{
+  const unsigned int nAngles = this->GetInput()->GetLargestPossibleRegion().GetSize(TInputImage::ImageDimension - 1);
+  const double       angspac = itk::Math::pi / nAngles;
+  const double       phi = 0.;
+  double             ang = angspac * 0.5 + itk::Math::pi_over_2;
+  m_CosWeights.resize(nAngles);
+  m_SinWeights.resize(nAngles);
+  for (unsigned int i = 0; i < nAngles; i++)
+  {
+    while (ang > itk::Math::pi)
+      ang -= itk::Math::pi;
+    double sign = 1.;
+    if (sin(ang - phi) < 0.)
+      sign = -1.;
+    m_CosWeights[i] = cos(ang) * sign * angspac;
+    m_SinWeights[i] = -1. * sin(ang) * sign * angspac;
+    ang += angspac;
   }
 }
 
@@ -45,46 +88,48 @@ void
 ZengBackProjectionImageFilter<TInputImage, TOutputImage>::DynamicThreadedGenerateData(
   const OutputImageRegionType & outputRegionForThread)
 {
-  typename TInputImage::IndexType idxIn;
-  for (unsigned int i = 0; i < TOutputImage::ImageDimension; i++)
-    idxIn[i] = outputRegionForThread.GetIndex(i);
-  idxIn[TOutputImage::ImageDimension] = 0;
-  const typename TInputImage::PixelType * pIn =
-    this->GetInput()->GetBufferPointer() + this->GetInput()->ComputeOffset(idxIn);
-  typename OutputImageRegionType::SizeValueType npix =
-    this->GetOutput()->GetLargestPossibleRegion().GetNumberOfPixels();
-
-  // Input / ouput iterators
-  itk::ImageRegionIterator<OutputImageType> itOutC(this->GetOutput(0), outputRegionForThread);
-  itk::ImageRegionIterator<OutputImageType> itOutS(this->GetOutput(1), outputRegionForThread);
-
-  double angspac =
-    itk::Math::pi / this->GetInput()->GetLargestPossibleRegion().GetSize(TInputImage::ImageDimension - 1);
-  const double phi = 0.;
-  while (!itOutC.IsAtEnd())
+  const unsigned int         angleDimension = TInputImage::ImageDimension - 1;
+  const TInputImage *        input = this->GetInput();
+  const unsigned int         nAngles = m_CosWeights.size();
+  const itk::OffsetValueType angleStride = input->GetOffsetTable()[angleDimension];
+  const unsigned int         rowLength = outputRegionForThread.GetSize(0);
+
+  // The output region is processed row by row. For each row, the angles are
+  // accumulated one after the other over the contiguous pixels of the row.
+  OutputImageRegionType rowStarts = outputRegionForThread;
+  rowStarts.SetSize(0, 1);
+  itk::ImageRegionConstIteratorWithIndex<OutputImageType> itRow(this->GetOutput(0), rowStarts);
+  std::vector<double>                                     vc(rowLength), vs(rowLength);
+  for (; !itRow.IsAtEnd(); ++itRow)
   {
-    double                                  ang = angspac * 0.5 + itk::Math::pi_over_2;
-    double                                  vs = 0.;
-    double                                  vc = 0.;
-    const typename TInputImage::PixelType * pInCurr = pIn;
-    for (unsigned int i = 0; i < this->GetInput()->GetLargestPossibleRegion().GetSize(TInputImage::ImageDimension - 1);
-         i++)
+    typename TInputImage::IndexType idxIn;
+    for (unsigned int i = 0; i < TOutputImage::ImageDimension; i++)
+      idxIn[i] = itRow.GetIndex()[i];
+    idxIn[angleDimension] = input->GetLargestPossibleRegion().GetIndex(angleDimension);
+    const typename TInputImage::PixelType * pIn = input->GetBufferPointer() + input->ComputeOffset(idxIn);
+
+    std::fill(vc.begin(), vc.end(), 0.);
+    std::fill(vs.begin(), vs.end(), 0.);
+    for (unsigned int a = 0; a < nAngles; a++, pIn += angleStride)
+    {
+      const double wc = m_CosWeights[a];
+      const double ws = m_SinWeights[a];
+      for (unsigned int n = 0; n < rowLength; n++)
+      {
+        vc[n] += wc * pIn[n];
+        vs[n] += ws * pIn[n];
+      }
+    }
+
+    typename TOutputImage::PixelType * pOutC =
+      this->GetOutput(0)->GetBufferPointer() + this->GetOutput(0)->ComputeOffset(itRow.GetIndex());
+    typename TOutputImage::PixelType * pOutS =
+      this->GetOutput(1)->GetBufferPointer() + this->GetOutput(1)->ComputeOffset(itRow.GetIndex());
+    for (unsigned int n = 0; n < rowLength; n++)
     {
-      while (ang > itk::Math::pi)
-        ang -= itk::Math::pi;
-      double sign = 1.;
-      if (sin(ang - phi) < 0.)
-        sign = -1.;
-      vs += sin(ang) * (*pInCurr) * sign;
-      vc += cos(ang) * (*pInCurr) * sign;
-      ang += angspac;
-      pInCurr += npix;
+      pOutC[n] = vc[n];
+      pOutS[n] = vs[n];
     }
-    itOutC.Set(vc * angspac);
-    itOutS.Set(-1. * vs * angspac);
-    ++itOutC;
-    ++itOutS;
-    ++pIn;
   }
 }
 
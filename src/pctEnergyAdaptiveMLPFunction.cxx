@@ -76,54 +76,29 @@ EnergyAdaptiveMLPFunction ::Init(const VectorType posIn,
 
 // vectorised version
 void
-EnergyAdaptiveMLPFunction ::Evaluate(std::vector<double> u, std::vector<double> & x, std::vector<double> & y)
+EnergyAdaptiveMLPFunction ::Evaluate(const double * u, const size_t n, double * x, double * y)
 {
-  // shift so u starts at 0 and scale by a/b to get u_tilde
-  for (auto & element : u)
-  {
-    element -= m_uOrigin;
-    element *= (m_ab[0] / m_ab[1]);
-  }
-
-  // uLog = log(u_tilde + 1)
-  std::vector<double> uLog;
-  uLog.reserve(u.size());
-  std::copy(u.begin(), u.end(), std::back_inserter(uLog));
-  for (auto & element : uLog)
-  {
-    element += 1;
-    element = std::log(element);
-  }
-
 #ifdef MLP_TIMING
   m_EvaluateProbe1.Start();
 #endif
 
-  /* terms order 0, 1, 2 */
-  std::fill(x.begin(), x.end(), m_dm_x[2]);
-  std::transform(x.begin(), x.end(), u.begin(), x.begin(), std::multiplies<double>());
-  std::transform(x.begin(), x.end(), x.begin(), std::bind(std::plus<double>(), std::placeholders::_1, m_dm_x[1]));
-  std::transform(x.begin(), x.end(), u.begin(), x.begin(), std::multiplies<double>());
-  std::transform(x.begin(), x.end(), x.begin(), std::bind(std::plus<double>(), std::placeholders::_1, m_dm_x[0]));
-
-  std::fill(y.begin(), y.end(), m_dm_y[2]);
-  std::transform(y.begin(), y.end(), u.begin(), y.begin(), std::multiplies<double>());
-  std::transform(y.begin(), y.end(), y.begin(), std::bind(std::plus<double>(), std::placeholders::_1, m_dm_y[1]));
-  std::transform(y.begin(), y.end(), u.begin(), y.begin(), std::multiplies<double>());
-  std::transform(y.begin(), y.end(), y.begin(), std::bind(std::plus<double>(), std::placeholders::_1, m_dm_y[0]));
-
-  /* logarithmic term */
-  std::transform(u.begin(), u.end(), u.begin(), std::bind(std::plus<double>(), std::placeholders::_1, 1)); // u => u+1
-  std::transform(u.begin(), u.end(), uLog.begin(), uLog.begin(), std::multiplies<double>()); // uLog = (u+1)*log(u+1)
-  std::transform(
-    uLog.begin(), uLog.end(), uLog.begin(), std::bind(std::multiplies<double>(), std::placeholders::_1, m_dm_x[3]));
-  std::transform(x.begin(), x.end(), uLog.begin(), x.begin(), std::plus<double>());
-  std::transform(uLog.begin(),
-                 uLog.end(),
-                 uLog.begin(),
-                 std::bind(std::multiplies<double>(), std::placeholders::_1, m_dm_y[3] / m_dm_x[3]));
-  std::transform(y.begin(), y.end(), uLog.begin(), y.begin(), std::plus<double>());
-
+  const double scale = m_ab[0] / m_ab[1];
+  for (size_t i = 0; i < n; i++)
+  {
+    // shift so u starts at 0 and scale by a/b to get u_tilde
+    const double ut = (u[i] - m_uOrigin) * scale;
+
+    /* terms order 0, 1, 2 */
+    x[i] = (m_dm_x[2] * ut + m_dm_x[1]) * ut + m_dm_x[0];
+    y[i] = (m_dm_y[2] * ut + m_dm_y[1]) * ut + m_dm_y[0];
+
+    /* logarithmic term, (u_tilde+1)*log(u_tilde+1) */
+    double uLog = (ut + 1) * std::log(ut + 1);
+    uLog *= m_dm_x[3];
+    x[i] += uLog;
+    uLog *= m_dm_y[3] / m_dm_x[3];
+    y[i] += uLog;
+  }
 
 #ifdef MLP_TIMING
   m_EvaluateProbe1.Stop();
@@ -142,37 +142,27 @@ PolynomialMLPFunction ::Init(const VectorType posIn,
 
 // vectorised version
 void
-PolynomialMLPFunction ::Evaluate(std::vector<double> u, std::vector<double> & x, std::vector<double> & y)
+PolynomialMLPFunction ::Evaluate(const double * u, const size_t n, double * x, double * y)
 {
-  for (auto & element : u)
-    element -= m_uOrigin;
-
-  x.resize(u.size());
-  y.resize(u.size());
-  std::fill(x.begin(), x.end(), 0.);
-  std::fill(y.begin(), y.end(), 0.);
-
 #ifdef MLP_TIMING
   m_EvaluateProbe1.Start();
 #endif
 
-  for (int i = 0; i != m_PolynomialDegreePlusThree; i++)
+  // Horner scheme
+  for (size_t j = 0; j < n; j++)
   {
-    for (auto & element : x)
-      element += m_dm_x[m_PolynomialDegreePlusThree - i];
-    std::transform(x.begin(), x.end(), u.begin(), x.begin(), std::multiplies<double>());
-
-    for (auto & element : y)
-      element += m_dm_y[m_PolynomialDegreePlusThree - i];
-    std::transform(y.begin(), y.end(), u.begin(), y.begin(), std::multiplies<double>());
+    const double uj = u[j] - m_uOrigin;
+    double       xj = 0.;
+    double       yj = 0.;
+    for (int i = 0; i != m_PolynomialDegreePlusThree; i++)
+    {
+      xj = (xj + m_dm_x[m_PolynomialDegreePlusThree - i]) * uj;
+      yj = (yj + m_dm_y[m_PolynomialDegreePlusThree - i]) * uj;
+    }
+    x[j] = xj + m_dm_x[0];
+    y[j] = yj + m_dm_y[0];
   }
 
-  for (auto & element : x)
-    element += m_dm_x[0];
-  for (auto & element : y)
-    element += m_dm_y[0];
-
-
 #ifdef MLP_TIMING
   m_EvaluateProbe1.Stop();
 #endif
@@ -0,0 +1,153 @@
+/*=========================================================================
+ *
+ *  Copyright Centre National de la Recherche Scientifique
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "pctProtonPairsChunkReader.h"
+
+#include <itkImageFileReader.h>
+
+#include <algorithm>
+
+namespace pct
+{
+
+ProtonPairsChunkReader ::~ProtonPairsChunkReader()
+{
+  this->Stop();
+}
+
+void
+ProtonPairsChunkReader ::Start()
+{
+  this->Stop();
+
+  using ReaderType = itk::ImageFileReader<ProtonPairsImageType>;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(m_FileName);
+  reader->UpdateOutputInformation();
+  m_LargestPossibleRegion = reader->GetOutput()->GetLargestPossibleRegion();
+
+  // Split the pairs (second dimension) in chunks
+  const itk::SizeValueType nPairs = m_LargestPossibleRegion.GetSize(1);
+  const itk::SizeValueType chunkSize = (m_NumberOfPairsPerChunk == 0) ? nPairs : m_NumberOfPairsPerChunk;
+  m_ChunkRegions.clear();
+  for (itk::SizeValueType first = 0; first < nPairs; first += chunkSize)
+  {
+    RegionType region = m_LargestPossibleRegion;
+    region.SetIndex(1, m_LargestPossibleRegion.GetIndex(1) + first);
+    region.SetSize(1, std::min(chunkSize, nPairs - first));
+    m_ChunkRegions.push_back(region);
+  }
+
+  m_Chunks.assign(m_ChunkRegions.size(), nullptr);
+  m_NumberOfPendingPairs.clear();
+  for (const RegionType & region : m_ChunkRegions)
+    m_NumberOfPendingPairs.push_back(region.GetSize(1));
+  m_NumberOfLoadedChunks = 0;
+  m_NumberOfChunksInMemory = 0;
+  m_Aborted = false;
+  m_Exception = nullptr;
+  m_Thread = std::thread(&Self::ReadChunks, this);
+}
+
+void
+ProtonPairsChunkReader ::ReadChunks()
+{
+  try
+  {
+    for (unsigned int i = 0; i < m_ChunkRegions.size(); i++)
+    {
+      // Wait for a free slot
+      {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_ConditionVariable.wait(lock, [this] {
+          return m_Aborted || m_NumberOfChunksInMemory < std::max(m_NumberOfChunksInFlight, 1u);
+        });
+        if (m_Aborted)
+          return;
+        m_NumberOfChunksInMemory++;
+      }
+
+      using ReaderType = itk::ImageFileReader<ProtonPairsImageType>;
+      ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(m_FileName);
+      reader->UpdateOutputInformation();
+      reader->GetOutput()->SetRequestedRegion(m_ChunkRegions[i]);
+      reader->Update();
+      ProtonPairsImagePointer chunk = reader->GetOutput();
+      chunk->DisconnectPipeline();
+
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Chunks[i] = chunk;
+      m_NumberOfLoadedChunks++;
+      m_ConditionVariable.notify_all();
+    }
+  }
+  catch (...)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Exception = std::current_exception();
+    m_Aborted = true;
+    m_ConditionVariable.notify_all();
+  }
+}
+
+ProtonPairsChunkReader::ProtonPairsImagePointer
+ProtonPairsChunkReader ::GetChunk(const unsigned int i)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_ConditionVariable.wait(lock, [this, i] { return m_Aborted || i < m_NumberOfLoadedChunks; });
+  if (m_Exception)
+    std::rethrow_exception(m_Exception);
+  if (m_Aborted)
+    return nullptr;
+  return m_Chunks[i];
+}
+
+void
+ProtonPairsChunkReader ::ReleasePairs(const unsigned int i, const itk::SizeValueType n)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (i >= m_NumberOfLoadedChunks || m_NumberOfPendingPairs[i] == 0)
+    return;
+  m_NumberOfPendingPairs[i] -= std::min(n, m_NumberOfPendingPairs[i]);
+  if (m_NumberOfPendingPairs[i] == 0)
+  {
+    m_Chunks[i] = nullptr;
+    m_NumberOfChunksInMemory--;
+    m_ConditionVariable.notify_all();
+  }
+}
+
+void
+ProtonPairsChunkReader ::Abort()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Aborted = true;
+  m_ConditionVariable.notify_all();
+}
+
+void
+ProtonPairsChunkReader ::Stop()
+{
+  this->Abort();
+  if (m_Thread.joinable())
+    m_Thread.join();
+  m_Chunks.clear();
+}
+
+} // namespace pct
@@ -18,13 +18,56 @@
 
 #include "pctSchulteMLPFunction.h"
 
+#include <itkMath.h>
+
 namespace pct
 {
 
+namespace
+{
+// Closed-form 2x2 matrix, row major, for the vectorised Evaluate
+struct Matrix2x2
+{
+  double a, b, c, d;
+};
+
+inline Matrix2x2
+operator+(const Matrix2x2 & m, const Matrix2x2 & n)
+{
+  return { m.a + n.a, m.b + n.b, m.c + n.c, m.d + n.d };
+}
+
+inline Matrix2x2
+operator*(const Matrix2x2 & m, const Matrix2x2 & n)
+{
+  return { m.a * n.a + m.b * n.c, m.a * n.b + m.b * n.d, m.c * n.a + m.d * n.c, m.c * n.b + m.d * n.d };
+}
+
+inline Matrix2x2
+operator*(const double s, const Matrix2x2 & m)
+{
+  return { s * m.a, s * m.b, s * m.c, s * m.d };
+}
+
+inline Matrix2x2
+Inverse(const Matrix2x2 & m)
+{
+  const double invDet = 1. / (m.a * m.d - m.b * m.c);
+  return { invDet * m.d, -invDet * m.b, -invDet * m.c, invDet * m.a };
+}
+
+inline Matrix2x2
+ToMatrix2x2(const itk::Matrix<double, 2, 2> & m)
+{
+  return { m(0, 0), m(0, 1), m(1, 0), m(1, 1) };
+}
+} // namespace
+
 SchulteMLPFunction ::SchulteMLPFunction()
 {
   // We apply a change of origin, u0 is always 0
   m_u0 = 0.;
+  m_CanBeVectorised = true;
 
   // Construct the constant part of R0 and R1 (equations 11 and 14)
   m_R0(0, 0) = 1.;
@@ -113,11 +156,214 @@ SchulteMLPFunction ::Init(const VectorType posIn,
   m_y0[1] = std::atan(dirIn[1]); // dirIn[2] is implicitely 1.
   m_y2[0] = posOut[1];
   m_y2[1] = std::atan(dirOut[1]); // dirOut[2] is implicitely 1.
+
+  // Rows of the table surrounding m_u2
+  m_UseTable =
+    m_Table.IsNotNull() && !m_considerTrackerUncertainties && m_u2 > 0. && m_u2 <= m_Table->GetMaxLength();
+  if (m_UseTable)
+  {
+    const double       l = m_u2 / m_Table->GetStep();
+    const unsigned int l0 = std::min(itk::Math::Floor<unsigned int>(l), m_Table->GetNumberOfSamples() - 2);
+    m_TableRow0 = m_Table->GetRow(l0);
+    m_TableRow1 = m_Table->GetRow(l0 + 1);
+    m_TableRowWeight = l - l0;
+    m_TableDepthScale = (m_Table->GetNumberOfSamples() - 1) / m_u2;
+  }
+}
+
+void
+SchulteMLPFunction ::Evaluate(const double * u, const size_t n, double * x, double * y)
+{
+  double dx, dy;
+  if (m_UseTable)
+  {
+    for (size_t i = 0; i < n; i++)
+      this->EvaluateFromTable(u[i] - m_uOrigin, x[i], y[i], dx, dy);
+    return;
+  }
+
+#ifdef MLP_TIMING
+  m_EvaluateProbe1.Start();
+#endif
+
+  // Tracker uncertainties, constant for the trajectory
+  Matrix2x2 trackerIn = { 0., 0., 0., 0. };
+  Matrix2x2 trackerOut = trackerIn;
+  if (m_considerTrackerUncertainties)
+  {
+    trackerIn = ToMatrix2x2(m_Sin * m_SigmaIn * m_SinT);
+    trackerOut = ToMatrix2x2(m_Sout_Inv * m_SigmaOut * m_SoutT_Inv);
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    const double u1 = u[i] - m_uOrigin;
+    const double u21 = m_u2 - u1;
+
+    // Rotation matrices (equations 11 and 14)
+    const Matrix2x2 R0 = { 1., u1, 0., 1. };
+    const Matrix2x2 R0T = { 1., 0., u1, 1. };
+    const Matrix2x2 R1 = { 1., u21, 0., 1. };
+    const Matrix2x2 R1T = { 1., 0., u21, 1. };
+    const Matrix2x2 R1_Inv = { 1., -u21, 0., 1. };
+    const Matrix2x2 R1T_Inv = { 1., 0., -u21, 1. };
+
+    // Constants used in both integrals
+    const double intForSigmaSqTheta1 = Functor::SchulteMLP::IntegralForSigmaSqTheta ::GetValue(u1);
+    const double intForSigmaSqTTheta1 = Functor::SchulteMLP::IntegralForSigmaSqTTheta::GetValue(u1);
+    const double intForSigmaSqT1 = Functor::SchulteMLP::IntegralForSigmaSqT ::GetValue(u1);
+
+    // Sigma1 (equations 6-9)
+    Matrix2x2 sigma1;
+    sigma1.d = intForSigmaSqTheta1;
+    sigma1.b = u1 * sigma1.d - intForSigmaSqTTheta1;
+    sigma1.c = sigma1.b;
+    sigma1.a = u1 * (2 * sigma1.b - u1 * sigma1.d) + intForSigmaSqT1;
+    sigma1 = Functor::SchulteMLP::ConstantPartOfIntegrals::GetValue(m_u0, u1) * sigma1;
+
+    // Sigma2 (equations 15-18)
+    Matrix2x2 sigma2;
+    sigma2.d = m_IntForSigmaSqTheta2 - intForSigmaSqTheta1;
+    sigma2.b = m_u2 * sigma2.d - m_IntForSigmaSqTTheta2 + intForSigmaSqTTheta1;
+    sigma2.c = sigma2.b;
+    sigma2.a = m_u2 * (2 * sigma2.b - m_u2 * sigma2.d) + m_IntForSigmaSqT2 - intForSigmaSqT1;
+    sigma2 = Functor::SchulteMLP::ConstantPartOfIntegrals::GetValue(u1, m_u2) * sigma2;
+
+    // Same algebra as the scalar Evaluate
+    Matrix2x2 factorIn, factorOut;
+    if (m_considerTrackerUncertainties)
+    {
+      const Matrix2x2 C1 = R0 * trackerIn * R0T + sigma1;
+      const Matrix2x2 C2 = R1_Inv * trackerOut * R1T_Inv + R1_Inv * sigma2 * R1T_Inv;
+      const Matrix2x2 C1plusC2_Inv = Inverse(C1 + C2);
+      factorIn = C2 * C1plusC2_Inv * R0;
+      factorOut = C1 * C1plusC2_Inv * R1_Inv;
+    }
+    else
+    {
+      factorIn = R1_Inv * sigma2 * Inverse(R1_Inv * sigma2 + sigma1 * R1T) * R0;
+      factorOut = sigma1 * Inverse(R1 * sigma1 + sigma2 * R1T_Inv);
+    }
+
+    x[i] = factorIn.a * m_x0[0] + factorIn.b * m_x0[1] + factorOut.a * m_x2[0] + factorOut.b * m_x2[1];
+    y[i] = factorIn.a * m_y0[0] + factorIn.b * m_y0[1] + factorOut.a * m_y2[0] + factorOut.b * m_y2[1];
+  }
+
+#ifdef MLP_TIMING
+  m_EvaluateProbe1.Stop();
+#endif
+}
+
+void
+SchulteMLPFunction ::EvaluateFromTable(const double u1, double & x, double & y, double & dx, double & dy) const
+{
+  // Bilinear interpolation of the weights in length and relative depth
+  const double       t = std::max(0., std::min(u1 * m_TableDepthScale, m_Table->GetNumberOfSamples() - 1.));
+  const unsigned int k = std::min(itk::Math::Floor<unsigned int>(t), m_Table->GetNumberOfSamples() - 2);
+  const double       fk = t - k;
+  const double       f00 = (1. - m_TableRowWeight) * (1. - fk);
+  const double       f01 = (1. - m_TableRowWeight) * fk;
+  const double       f10 = m_TableRowWeight * (1. - fk);
+  const double       f11 = m_TableRowWeight * fk;
+
+  double w[8];
+  for (unsigned int i = 0; i < 8; i++)
+    w[i] = f00 * m_TableRow0[k][i] + f01 * m_TableRow0[k + 1][i] + f10 * m_TableRow1[k][i] +
+           f11 * m_TableRow1[k + 1][i];
+
+  x = w[0] * m_x0[0] + w[1] * m_x0[1] + w[2] * m_x2[0] + w[3] * m_x2[1];
+  dx = w[4] * m_x0[0] + w[5] * m_x0[1] + w[6] * m_x2[0] + w[7] * m_x2[1];
+  y = w[0] * m_y0[0] + w[1] * m_y0[1] + w[2] * m_y2[0] + w[3] * m_y2[1];
+  dy = w[4] * m_y0[0] + w[5] * m_y0[1] + w[6] * m_y2[0] + w[7] * m_y2[1];
+}
+
+void
+SchulteMLPFunction ::ComputeWeights(const double u1, const double u2, SchulteMLPTable::WeightsType & w)
+{
+  // Rotation matrices (equations 11 and 14)
+  itk::Matrix<double, 2, 2> R0, R1;
+  R0(0, 0) = 1.;
+  R0(0, 1) = u1;
+  R0(1, 0) = 0.;
+  R0(1, 1) = 1.;
+  R1 = R0;
+  R1(0, 1) = u2 - u1;
+  itk::Matrix<double, 2, 2> R1T(R1.GetTranspose());
+  itk::Matrix<double, 2, 2> R1T_Inv(R1T);
+  InverseMatrix(R1T_Inv);
+  itk::Matrix<double, 2, 2> R1_Inv(R1);
+  InverseMatrix(R1_Inv);
+
+  const double intForSigmaSqTheta1 = Functor::SchulteMLP::IntegralForSigmaSqTheta ::GetValue(u1);
+  const double intForSigmaSqTTheta1 = Functor::SchulteMLP::IntegralForSigmaSqTTheta::GetValue(u1);
+  const double intForSigmaSqT1 = Functor::SchulteMLP::IntegralForSigmaSqT ::GetValue(u1);
+  const double intForSigmaSqTheta2 = Functor::SchulteMLP::IntegralForSigmaSqTheta ::GetValue(u2);
+  const double intForSigmaSqTTheta2 = Functor::SchulteMLP::IntegralForSigmaSqTTheta::GetValue(u2);
+  const double intForSigmaSqT2 = Functor::SchulteMLP::IntegralForSigmaSqT ::GetValue(u2);
+
+  // Sigma1 (equations 6-9)
+  itk::Matrix<double, 2, 2> sigma1;
+  sigma1(1, 1) = intForSigmaSqTheta1;
+  sigma1(0, 1) = u1 * sigma1(1, 1) - intForSigmaSqTTheta1;
+  sigma1(1, 0) = sigma1(0, 1);
+  sigma1(0, 0) = u1 * (2 * sigma1(0, 1) - u1 * sigma1(1, 1)) + intForSigmaSqT1;
+  sigma1 *= Functor::SchulteMLP::ConstantPartOfIntegrals::GetValue(0., u1);
+
+  // Sigma2 (equations 15-18)
+  itk::Matrix<double, 2, 2> sigma2;
+  sigma2(1, 1) = intForSigmaSqTheta2 - intForSigmaSqTheta1;
+  sigma2(0, 1) = u2 * sigma2(1, 1) - intForSigmaSqTTheta2 + intForSigmaSqTTheta1;
+  sigma2(1, 0) = sigma2(0, 1);
+  sigma2(0, 0) = u2 * (2 * sigma2(0, 1) - u2 * sigma2(1, 1)) + intForSigmaSqT2 - intForSigmaSqT1;
+  sigma2 *= Functor::SchulteMLP::ConstantPartOfIntegrals::GetValue(u1, u2);
+
+  // Same as Evaluate without tracker uncertainties
+  itk::Matrix<double, 2, 2> sum1(R1_Inv * sigma2 + sigma1 * R1T);
+  InverseMatrix(sum1);
+  itk::Matrix<double, 2, 2> sum2(R1 * sigma1 + sigma2 * R1T_Inv);
+  InverseMatrix(sum2);
+  itk::Matrix<double, 2, 2> part1(R1_Inv * sigma2 * sum1 * R0);
+  itk::Matrix<double, 2, 2> part2(sigma1 * sum2);
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    w[4 * i] = part1(i, 0);
+    w[4 * i + 1] = part1(i, 1);
+    w[4 * i + 2] = part2(i, 0);
+    w[4 * i + 3] = part2(i, 1);
+  }
+}
+
+void
+SchulteMLPTable ::Compute(const double maxLength, const double step)
+{
+  if (step <= 0. || maxLength <= 0.)
+    itkExceptionMacro(<< "The length and the step of the table must be positive.");
+
+  m_MaxLength = maxLength;
+  m_NumberOfSamples = std::max(2, itk::Math::Ceil<int>(maxLength / step) + 1);
+  m_Step = maxLength / (m_NumberOfSamples - 1);
+  m_Weights.resize(m_NumberOfSamples * m_NumberOfSamples);
+
+  // The first row (u2=0) is degenerate and copied from the second one
+  for (unsigned int l = 1; l < m_NumberOfSamples; l++)
+  {
+    const double u2 = l * m_Step;
+    for (unsigned int k = 0; k < m_NumberOfSamples; k++)
+      SchulteMLPFunction::ComputeWeights(u2 * k / (m_NumberOfSamples - 1), u2, m_Weights[l * m_NumberOfSamples + k]);
+  }
+  std::copy(m_Weights.begin() + m_NumberOfSamples, m_Weights.begin() + 2 * m_NumberOfSamples, m_Weights.begin());
 }
 
 void
 SchulteMLPFunction ::Evaluate(const double u, double & x, double & y, double & dx, double & dy)
 {
+  if (m_UseTable)
+  {
+    this->EvaluateFromTable(u - m_uOrigin, x, y, dx, dy);
+    return;
+  }
+
 #ifdef MLP_TIMING
   m_EvaluateProbe1.Start();
 #endif
@@ -208,7 +454,10 @@ SchulteMLPFunction ::EvaluateError(const double u, itk::Matrix<double, 2, 2> & e
 {
   double x, y;
   double dx, dy;
+  const bool useTable = m_UseTable; // The scattering matrices are required
+  m_UseTable = false;
   Evaluate(u, x, y, dx, dy);
+  m_UseTable = useTable;
   error = m_Sigma1 + m_R1T * m_Sigma2 * m_R1;
   InverseMatrix(error);
   error *= 2.;
@@ -0,0 +1,124 @@
+/*=========================================================================
+ *
+ *  Copyright Centre National de la Recherche Scientifique
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+
+#include "pctHoleFillingImageFilter.h"
+#include "SmallHoleFiller.h"
+
+#include "itkTestingMacros.h"
+
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkMath.h>
+
+#include <random>
+
+int
+pctHoleFillingImageFilterTest(int, char *[])
+{
+  constexpr unsigned int Dimension = 3;
+  using PixelType = float;
+  using ImageType = itk::Image<PixelType, Dimension>;
+
+  using FilterType = pct::HoleFillingImageFilter<ImageType>;
+  FilterType::Pointer filter = FilterType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(filter, HoleFillingImageFilter, InPlaceImageFilter);
+
+  // Known values in [1,2] with a ball of holes and 30% of isolated holes,
+  // more holes than the blocks of the filter
+  ImageType::Pointer  image = ImageType::New();
+  ImageType::SizeType size;
+  size[0] = 32;
+  size[1] = 32;
+  size[2] = 16;
+  image->SetRegions(size);
+  image->Allocate();
+  std::mt19937                          generator(0);
+  std::uniform_real_distribution<float> value(1.f, 2.f);
+  std::bernoulli_distribution           isolatedHole(0.3);
+  unsigned int                          nHoles = 0;
+  for (itk::ImageRegionIteratorWithIndex<ImageType> it(image, image->GetLargestPossibleRegion()); !it.IsAtEnd(); ++it)
+  {
+    const ImageType::IndexType idx = it.GetIndex();
+    const long                 dx = idx[0] - 12, dy = idx[1] - 14, dz = idx[2] - 8;
+    const float                v = value(generator);
+    if (dx * dx + dy * dy + dz * dz <= 36 || isolatedHole(generator))
+    {
+      it.Set(0.f);
+      nHoles++;
+    }
+    else
+      it.Set(v);
+  }
+  std::cout << nHoles << " holes out of " << image->GetLargestPossibleRegion().GetNumberOfPixels() << " voxels."
+            << std::endl;
+
+  // Reference
+  SmallHoleFiller<ImageType> reference;
+  reference.SetImage(image);
+  reference.SetHolePixel(0.f);
+  reference.Fill();
+
+  // The result must be the same as the reference and must not depend on the number of threads
+  ImageType::Pointer firstOutput;
+  for (const unsigned int threads : { 1, 2, 8 })
+  {
+    filter = FilterType::New();
+    filter->SetInput(image);
+    filter->SetInPlace(false);
+    filter->SetHolePixel(0.f);
+    filter->GetMultiThreader()->SetMaximumNumberOfThreads(threads);
+    filter->GetMultiThreader()->SetNumberOfWorkUnits(threads);
+    ITK_TRY_EXPECT_NO_EXCEPTION(filter->Update());
+    std::cout << "Holes filled in " << filter->GetNumberOfLayers() << " layers with " << threads << " thread(s)."
+              << std::endl;
+
+    itk::ImageRegionConstIterator<ImageType> itRef(reference.GetOutput(),
+                                                   reference.GetOutput()->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<ImageType> it(filter->GetOutput(), filter->GetOutput()->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it, ++itRef)
+    {
+      if (it.Get() == 0.f || itk::Math::abs(it.Get() - itRef.Get()) > 1e-5)
+      {
+        std::cerr << "Test failed with " << threads << " thread(s) at " << it.GetIndex() << ": " << it.Get()
+                  << " instead of " << itRef.Get() << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (firstOutput.IsNull())
+    {
+      firstOutput = filter->GetOutput();
+      continue;
+    }
+    itk::ImageRegionConstIterator<ImageType> itFirst(firstOutput, firstOutput->GetLargestPossibleRegion());
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it, ++itFirst)
+    {
+      if (it.Get() != itFirst.Get())
+      {
+        std::cerr << "Test failed, the result with " << threads << " threads differs from the one with 1 thread at "
+                  << it.GetIndex() << ": " << it.Get() << " instead of " << itFirst.Get() << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  std::cout << "Test finished." << std::endl;
+  return EXIT_SUCCESS;
+}
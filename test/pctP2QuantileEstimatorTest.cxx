@@ -0,0 +1,86 @@
+/*=========================================================================
+ *
+ *  Copyright Centre National de la Recherche Scientifique
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+
+#include "pctP2QuantileEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+int
+pctP2QuantileEstimatorTest(int, char *[])
+{
+  // Up to 5 observations, the quantile is interpolated exactly between the
+  // sorted observations of rank ceil(n p) and ceil(n p) - 1
+  struct SmallCase
+  {
+    std::vector<double> observations;
+    double              p;
+    double              expected;
+  };
+  const std::vector<SmallCase> smallCases = { { { 7. }, 0.5, 7. },
+                                              { { 3., 1. }, 0.5, 3. },
+                                              { { 3., 1. }, 0.25, 2. },
+                                              { { 4., 1., 2. }, 0.5, 3. },
+                                              { { 4., 1., 2., 8. }, 0.3085, 2.468 },
+                                              { { 4., 1., 2., 8. }, 0.383, 3.064 },
+                                              { { 5., 1., 4., 2., 3. }, 0.5, 3.5 },
+                                              { { 5., 1., 4., 2., 3. }, 0.3085, 2.5425 } };
+  for (const SmallCase & c : smallCases)
+  {
+    pct::P2QuantileEstimator estimator(c.p);
+    for (const double x : c.observations)
+      estimator.Add(x);
+    if (estimator.GetCount() != c.observations.size() || std::abs(estimator.GetQuantile() - c.expected) > 1e-12)
+    {
+      std::cerr << "Test failed with " << c.observations.size() << " observations and p=" << c.p << ": "
+                << estimator.GetQuantile() << " instead of " << c.expected << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Many observations of a normal distribution, compared with the sorted observations
+  const unsigned int               n = 100000;
+  std::mt19937                     generator(0);
+  std::normal_distribution<double> normal(0., 1.);
+  for (const double p : { 0.1, 0.3085, 0.383, 0.5, 0.9 })
+  {
+    pct::P2QuantileEstimator estimator(p);
+    std::vector<double>      observations(n);
+    for (double & x : observations)
+    {
+      x = normal(generator);
+      estimator.Add(x);
+    }
+    std::sort(observations.begin(), observations.end());
+    const double exact = observations[std::min(n - 1, (unsigned int)std::ceil(n * p))];
+    if (std::abs(estimator.GetQuantile() - exact) > 0.005)
+    {
+      std::cerr << "Test failed with " << n << " observations and p=" << p << ": " << estimator.GetQuantile()
+                << " instead of " << exact << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Test finished." << std::endl;
+  return EXIT_SUCCESS;
+}
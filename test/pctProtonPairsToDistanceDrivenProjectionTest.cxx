@@ -20,9 +20,28 @@
 
 #include "itkTestingMacros.h"
 
+#include <rtkConstantImageSource.h>
+#include <itkImageFileWriter.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkMath.h>
+#include <itkMultiThreaderBase.h>
+
+#include <random>
+
 int
 pctProtonPairsToDistanceDrivenProjectionTest(int argc, char* argv[])
 {
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << itkNameOfTestExecutableMacro(argv) << " pairsFile" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // A single pool thread for more work units than threads, the work units do
+  // not run concurrently and must not wait for each other
+  itk::MultiThreaderBase::SetGlobalDefaultThreader(itk::MultiThreaderBase::ThreaderEnum::Pool);
+  itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(1);
+
   constexpr unsigned int Dimension = 3;
   using PixelType = float;
   using ImageType = itk::Image<PixelType, Dimension>;
@@ -32,6 +51,112 @@ pctProtonPairsToDistanceDrivenProjectionTest(int argc, char* argv[])
 
   ITK_EXERCISE_BASIC_OBJECT_METHODS(filter, ProtonPairsToDistanceDrivenProjection, InPlaceImageFilter);
 
-  
+  // Straight protons parallel to z with a WEPL depending on x
+  const unsigned int                         nprotons = 1000;
+  FilterType::ProtonPairsImageType::Pointer  pairs = FilterType::ProtonPairsImageType::New();
+  FilterType::ProtonPairsImageType::SizeType pairsSize;
+  pairsSize[0] = 5;
+  pairsSize[1] = nprotons;
+  pairs->SetRegions(pairsSize);
+  pairs->Allocate();
+  std::mt19937                          generator(0);
+  std::uniform_real_distribution<float> position(-7.f, 7.f);
+  for (unsigned int p = 0; p < nprotons; p++)
+  {
+    FilterType::ProtonPairsPixelType pIn, pOut, d, e;
+    pIn[0] = position(generator);
+    pIn[1] = position(generator);
+    pIn[2] = -10.f;
+    pOut = pIn;
+    pOut[2] = 10.f;
+    d[0] = 0.f;
+    d[1] = 0.f;
+    d[2] = 1.f;
+    e[0] = 0.f; // WEPL in e[1]
+    e[1] = 1.f + 0.1f * pIn[0];
+    e[2] = 0.f;
+    FilterType::ProtonPairsImageType::IndexType idx;
+    idx[0] = 0;
+    idx[1] = p;
+    pairs->SetPixel(idx, pIn);
+    idx[0]++;
+    pairs->SetPixel(idx, pOut);
+    idx[0]++;
+    pairs->SetPixel(idx, d);
+    idx[0]++;
+    pairs->SetPixel(idx, d);
+    idx[0]++;
+    pairs->SetPixel(idx, e);
+  }
+  using PairsWriterType = itk::ImageFileWriter<FilterType::ProtonPairsImageType>;
+  PairsWriterType::Pointer pairsWriter = PairsWriterType::New();
+  pairsWriter->SetFileName(argv[1]);
+  pairsWriter->SetInput(pairs);
+  ITK_TRY_EXPECT_NO_EXCEPTION(pairsWriter->Update());
+
+  // Bins the pairs with the given number of work units and pairs per chunk and per block
+  auto binning = [&](FilterType::Pointer &    projection,
+                     const unsigned int       workUnits,
+                     const itk::SizeValueType pairsPerChunk,
+                     const itk::SizeValueType pairsPerBlock) {
+    using ConstantImageSourceType = rtk::ConstantImageSource<ImageType>;
+    ConstantImageSourceType::Pointer source = ConstantImageSourceType::New();
+    ImageType::SizeType              size;
+    size.Fill(16);
+    size[2] = 4;
+    ImageType::SpacingType spacing(1.);
+    spacing[2] = 2.;
+    ImageType::PointType origin(-7.5);
+    origin[2] = -3.;
+    source->SetSize(size);
+    source->SetSpacing(spacing);
+    source->SetOrigin(origin);
+    source->SetConstant(0.);
+
+    projection = FilterType::New();
+    projection->SetInput(source->GetOutput());
+    projection->SetProtonPairsFileName(argv[1]);
+    projection->SetNumberOfWorkUnits(workUnits);
+    projection->SetNumberOfPairsPerChunk(pairsPerChunk);
+    projection->SetNumberOfPairsPerBlock(pairsPerBlock);
+    projection->SetSourceDistance(0.);
+    projection->SetMostLikelyPathType("schulte");
+    projection->SetMostLikelyPathPolynomialDegree(2);
+    projection->SetMostLikelyPathTrackerUncertainties(false);
+    projection->SetIonizationPotential(68.9984 * CLHEP::eV);
+    ITK_TRY_EXPECT_NO_EXCEPTION(projection->Update());
+  };
+
+  // Reference in a single chunk and work unit, then 8 work units for 1 thread
+  // with chunks and blocks which do not divide the number of pairs
+  FilterType::Pointer reference, streamed;
+  binning(reference, 1, 0, 4096);
+  binning(streamed, 8, 100, 7);
+
+  itk::ImageRegionConstIterator<FilterType::CountImageType> itRefCount(
+    reference->GetCount(), reference->GetCount()->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<FilterType::CountImageType> itCount(streamed->GetCount(),
+                                                                   streamed->GetCount()->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<ImageType> itRef(reference->GetOutput(),
+                                                 reference->GetOutput()->GetLargestPossibleRegion());
+  itk::ImageRegionConstIterator<ImageType> it(streamed->GetOutput(), streamed->GetOutput()->GetLargestPossibleRegion());
+  unsigned int totalCount = 0;
+  for (; !it.IsAtEnd(); ++it, ++itRef, ++itCount, ++itRefCount)
+  {
+    if (itCount.Get() != itRefCount.Get() || itk::Math::abs(it.Get() - itRef.Get()) > 1e-5)
+    {
+      std::cerr << "Test failed at " << it.GetIndex() << ": count " << itCount.Get() << " instead of "
+                << itRefCount.Get() << ", value " << it.Get() << " instead of " << itRef.Get() << std::endl;
+      return EXIT_FAILURE;
+    }
+    totalCount += itCount.Get();
+  }
+  if (totalCount == 0)
+  {
+    std::cerr << "Test failed: no pair binned." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Test finished." << std::endl;
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,88 @@
+/*=========================================================================
+ *
+ *  Copyright Centre National de la Recherche Scientifique
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+
+#include "pctSchulteMLPFunction.h"
+
+#include "itkTestingMacros.h"
+
+#include <itkMath.h>
+
+int
+pctSchulteMLPFunctionTest(int, char *[])
+{
+  using MLPType = pct::SchulteMLPFunction;
+  using VectorType = MLPType::VectorType;
+
+  MLPType::Pointer exact = MLPType::New();
+  MLPType::Pointer tabulated = MLPType::New();
+
+  // Table for protons up to 200 mm with two steps, the bilinear interpolation
+  // error is quadratic in the step for the positions and about linear in the
+  // step for the directions
+  const double maxLength = 200.;
+  for (const double step : { 1., 5. })
+  {
+    pct::SchulteMLPTable::Pointer table = pct::SchulteMLPTable::New();
+    ITK_TRY_EXPECT_NO_EXCEPTION(table->Compute(maxLength, step));
+    tabulated->SetTable(table);
+    const double positionTolerance = 1e-3 * step * step;
+    const double directionTolerance = 1e-3 * step;
+
+    // The last length is longer than the table, the exact MLP must be used
+    for (const double length : { 20.3, 100., 150.7, maxLength, 1.25 * maxLength })
+    {
+      VectorType posIn, posOut, dirIn, dirOut;
+      posIn[0] = 10.;
+      posIn[1] = -5.;
+      posIn[2] = -0.5 * length;
+      posOut[0] = 12.;
+      posOut[1] = -3.;
+      posOut[2] = 0.5 * length;
+      dirIn[0] = 0.05;
+      dirIn[1] = -0.02;
+      dirIn[2] = 1.;
+      dirOut[0] = 0.06;
+      dirOut[1] = 0.03;
+      dirOut[2] = 1.;
+      exact->Init(posIn, posOut, dirIn, dirOut);
+      tabulated->Init(posIn, posOut, dirIn, dirOut);
+
+      for (const double depth : { 0.02, 0.1, 0.33, 0.5, 0.77, 0.9, 0.98 })
+      {
+        const double u = posIn[2] + depth * length;
+        double       x, y, dx, dy, xt, yt, dxt, dyt;
+        exact->Evaluate(u, x, y, dx, dy);
+        tabulated->Evaluate(u, xt, yt, dxt, dyt);
+        const bool fallback = length > table->GetMaxLength();
+        if ((fallback && (x != xt || y != yt || dx != dxt || dy != dyt)) ||
+            itk::Math::abs(x - xt) > positionTolerance || itk::Math::abs(y - yt) > positionTolerance ||
+            itk::Math::abs(dx - dxt) > directionTolerance || itk::Math::abs(dy - dyt) > directionTolerance)
+        {
+          std::cerr << "Test failed for step " << step << ", length " << length << " and relative depth " << depth
+                    << ": (" << xt << ',' << yt << ',' << dxt << ',' << dyt << ") instead of (" << x << ',' << y << ','
+                    << dx << ',' << dy << ')' << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  std::cout << "Test finished." << std::endl;
+  return EXIT_SUCCESS;
+}